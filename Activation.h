@@ -0,0 +1,261 @@
+#ifndef ACTIVATION_H
+#define ACTIVATION_H
+
+/** \file Activation.h Activation and loss policies for neural networks.
+
+    BasicNeuralNet takes the activation function of its hidden layers,
+    that of its output layer, and its loss (cost) function as template
+    parameters.  The per-value work of the forward and backward passes
+    is thus resolved at compile time and inlined into the loops that
+    use it, without any virtual calls or std::function.
+
+    An activation policy provides four static members:
+
+    <ul>
+    <li><tt>function<T>(accuracy)</tt> returns the function that
+    computes the activations of a block of weighted inputs.  It is
+    fused into the dense-layer kernel (see gemm::dense), which calls it
+    once per block of values.  The sigmoid and tanh use the vectorized
+    functions of the given accuracy tier (see Simd.h); the others
+    ignore the accuracy.</li>
+
+    <li><tt>normalize(outputs, accuracy)</tt> finishes the outputs of a
+    layer, with one sample per column.  This is only needed by
+    activations that depend on all the outputs of a layer (softmax) and
+    does nothing for the element-wise activations.</li>
+
+    <li><tt>derivative(a)</tt> returns f'(z) given the activation a =
+    f(z), so that the backward pass needs neither the weighted inputs
+    nor any transcendental functions.  Softmax has no element-wise
+    derivative, so it can only be used for the output layer together
+    with loss::CrossEntropy.</li>
+
+    <li><tt>initRange(fanIn, fanOut)</tt> returns the half-width of the
+    uniform distribution from which BasicNeuralNet draws the initial
+    weights of a layer with \c fanIn inputs and \c fanOut neurons.
+    Sigmoid-like activations use the Xavier (Glorot) range and
+    rectifiers the He range, which keep the variance of the
+    activations about the same from layer to layer.</li>
+    </ul>
+
+    A loss policy provides <tt>delta<Output>(a, y)</tt>, the error of
+    an output neuron (the derivative of the loss with respect to its
+    weighted input) given its activation \c a and expected value \c y,
+    and <tt>accepts<Output></tt>, which is true if the loss can be used
+    with the given output activation.
+
+    Copyright (C) 2021 raodm@miamiOH.edu
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <ratio>
+#include <type_traits>
+#include "MatrixView.h"
+#include "Simd.h"
+
+/** The activation functions for the layers of neural networks. */
+namespace activation {
+
+/** The normalize() of the element-wise activations, which does
+    nothing. */
+struct Elementwise {
+    template<typename T>
+    static void normalize(const BasicMatrixView<T>&, simd::Accuracy) {}
+};
+
+/** The Xavier (Glorot) initialization, sqrt(6 / (fanIn + fanOut)),
+    for saturating activations such as the sigmoid. */
+struct XavierInit {
+    static double initRange(const size_t fanIn, const size_t fanOut) {
+        return std::sqrt(6.0 / (fanIn + fanOut));
+    }
+};
+
+/** The He initialization, sqrt(6 / fanIn), for rectifiers, which
+    zero out about half of their inputs. */
+struct HeInit {
+    static double initRange(const size_t fanIn, size_t) {
+        return std::sqrt(6.0 / fanIn);
+    }
+};
+
+/** The logistic sigmoid, 1 / (1 + e^-z), which is the default. */
+struct Sigmoid : Elementwise, XavierInit {
+    template<typename T>
+    static simd::ActivationFn<T> function(const simd::Accuracy accuracy) {
+        return simd::activations<T>(accuracy).sigmoid;
+    }
+
+    template<typename T>
+    static T derivative(const T a) {
+        return a * (1 - a);
+    }
+};
+
+/** The hyperbolic tangent, whose outputs are in (-1, 1). */
+struct Tanh : Elementwise, XavierInit {
+    template<typename T>
+    static simd::ActivationFn<T> function(const simd::Accuracy accuracy) {
+        return simd::activations<T>(accuracy).tanh;
+    }
+
+    template<typename T>
+    static T derivative(const T a) {
+        return 1 - a * a;
+    }
+};
+
+/**
+ * The rectified linear unit, max(0, z).  It is much cheaper than the
+ * sigmoid and does not saturate for positive inputs, so deep networks
+ * usually train in fewer epochs.  Neurons whose weighted inputs are
+ * never positive do not learn.
+ */
+struct ReLU : Elementwise, HeInit {
+    template<typename T>
+    static simd::ActivationFn<T> function(simd::Accuracy) {
+        return apply<T>;
+    }
+
+    template<typename T>
+    static void apply(const T* x, T* out, const size_t n) {
+        for (size_t i = 0; (i < n); i++) {
+            out[i] = (x[i] > 0) ? x[i] : T(0);
+        }
+    }
+
+    template<typename T>
+    static T derivative(const T a) {
+        return (a > 0) ? T(1) : T(0);
+    }
+};
+
+/**
+ * The leaky rectified linear unit: z for positive z and slope * z
+ * otherwise, so that neurons with negative inputs still learn.
+ *
+ * \tparam Slope The slope for negative inputs as a std::ratio, e.g.,
+ * std::ratio<1, 20> for 0.05.  It must be positive.
+ */
+template<typename Slope = std::ratio<1, 100>>
+struct LeakyReLU : Elementwise, HeInit {
+    static_assert(Slope::num > 0, "The slope must be positive");
+
+    template<typename T>
+    static simd::ActivationFn<T> function(simd::Accuracy) {
+        return apply<T>;
+    }
+
+    template<typename T>
+    static void apply(const T* x, T* out, const size_t n) {
+        const T slope = T(Slope::num) / T(Slope::den);
+        for (size_t i = 0; (i < n); i++) {
+            out[i] = (x[i] > 0) ? x[i] : (x[i] * slope);
+        }
+    }
+
+    template<typename T>
+    static T derivative(const T a) {
+        return (a > 0) ? T(1) : (T(Slope::num) / T(Slope::den));
+    }
+};
+
+/**
+ * The softmax, e^z_i / sum_j e^z_j over the neurons of a layer, whose
+ * outputs are a probability distribution.  It can only be used for
+ * the output layer together with loss::CrossEntropy.
+ */
+struct Softmax : XavierInit {
+    /** The dense-layer kernel keeps the weighted inputs, which are
+        replaced by normalize(). */
+    template<typename T>
+    static simd::ActivationFn<T> function(simd::Accuracy) {
+        return identity<T>;
+    }
+
+    template<typename T>
+    static void normalize(const BasicMatrixView<T>& outputs,
+                          const simd::Accuracy accuracy) {
+        const auto exp = simd::activations<T>(accuracy).exp;
+        const size_t rows = outputs.height(), ld = outputs.pitch();
+        // Each column is a sample.  Its largest value is subtracted
+        // before the exponentials so that they cannot overflow.  The
+        // values are exponentiated a block at a time via a buffer
+        // since the columns of a batch are strided.
+        constexpr size_t Block = 64;
+        T buf[Block];
+        for (size_t col = 0; (col < outputs.width()); col++) {
+            T* const z = outputs.data() + col;
+            T max = -std::numeric_limits<T>::infinity(), sum = 0;
+            for (size_t r = 0; (r < rows); r++) {
+                max = std::max(max, z[r * ld]);
+            }
+            for (size_t r0 = 0; (r0 < rows); r0 += Block) {
+                const size_t len = std::min(Block, rows - r0);
+                for (size_t i = 0; (i < len); i++) {
+                    buf[i] = z[(r0 + i) * ld] - max;
+                }
+                exp(buf, buf, len);
+                for (size_t i = 0; (i < len); i++) {
+                    z[(r0 + i) * ld] = buf[i];
+                    sum += buf[i];
+                }
+            }
+            const T scale = 1 / sum;
+            for (size_t r = 0; (r < rows); r++) {
+                z[r * ld] *= scale;
+            }
+        }
+    }
+
+private:
+    template<typename T>
+    static void identity(const T* x, T* out, const size_t n) {
+        if (x != out) {
+            std::copy_n(x, n, out);
+        }
+    }
+};
+
+}  // namespace activation
+
+/** The loss (cost) functions for training neural networks. */
+namespace loss {
+
+/** The quadratic cost, sum((a - y)^2) / 2, which is the default. */
+struct Quadratic {
+    template<typename Output>
+    static constexpr bool accepts =
+        !std::is_same<Output, activation::Softmax>::value;
+
+    template<typename Output, typename T>
+    static T delta(const T a, const T y) {
+        return (a - y) * Output::derivative(a);
+    }
+};
+
+/**
+ * The cross-entropy cost, -sum(y ln(a) + (1 - y) ln(1 - a)) for
+ * sigmoid outputs and -sum(y ln(a)) for softmax outputs (whose
+ * expected values must sum to 1).  The derivative of the activation
+ * cancels out, so the error is simply a - y and does not vanish when
+ * the outputs saturate, which speeds up learning.
+ */
+struct CrossEntropy {
+    template<typename Output>
+    static constexpr bool accepts =
+        std::is_same<Output, activation::Sigmoid>::value ||
+        std::is_same<Output, activation::Softmax>::value;
+
+    template<typename Output, typename T>
+    static T delta(const T a, const T y) {
+        return a - y;
+    }
+};
+
+}  // namespace loss
+
+#endif
@@ -0,0 +1,121 @@
+// Copyright (C) 2021 raodm@miamioh.edu
+
+#ifndef ALIGNED_BUFFER_CPP
+#define ALIGNED_BUFFER_CPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include "AlignedBuffer.h"
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+namespace memory {
+
+namespace {
+
+// The size of a transparent huge page on x86-64 Linux.
+constexpr size_t HugePageSize = size_t(2) << 20;
+
+// Rounds a size up to a multiple of a given power of two.
+size_t roundUp(const size_t bytes, const size_t multiple) {
+    return (bytes + multiple - 1) & ~(multiple - 1);
+}
+
+// Returns the initial huge-page threshold from the NN_HUGE_PAGES
+// environment variable, which gives the threshold in MiB.
+size_t thresholdFromEnv() {
+    const char* env = std::getenv("NN_HUGE_PAGES");
+    return (env == nullptr) ? 0 : (std::strtoull(env, nullptr, 10) << 20);
+}
+
+// The current threshold.  It is atomic so that it can be changed
+// while other threads allocate matrices.
+std::atomic<size_t> threshold(thresholdFromEnv());
+
+// The number of blocks allocated so far.
+std::atomic<size_t> allocations(0);
+
+#ifdef __linux__
+// Maps an anonymous region of len bytes (a multiple of HugePageSize)
+// aligned to a huge page and asks the kernel to back it with huge
+// pages.  Returns nullptr if the mapping fails.
+void* mapHugePages(const size_t len) {
+    // Over-allocate by one huge page so the region can be aligned,
+    // then give back the unused head and tail.
+    const size_t span = len + HugePageSize;
+    void* raw = mmap(nullptr, span, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) {
+        return nullptr;
+    }
+    const uintptr_t start = reinterpret_cast<uintptr_t>(raw);
+    const uintptr_t aligned = roundUp(start, HugePageSize);
+    if (aligned > start) {
+        munmap(raw, aligned - start);
+    }
+    const size_t tail = (start + span) - (aligned + len);
+    if (tail > 0) {
+        munmap(reinterpret_cast<void*>(aligned + len), tail);
+    }
+    void* ptr = reinterpret_cast<void*>(aligned);
+    // The advice is only a hint; the memory is usable either way.
+    madvise(ptr, len, MADV_HUGEPAGE);
+    return ptr;
+}
+#endif
+
+}  // namespace
+
+size_t hugePageThreshold() {
+    return threshold.load(std::memory_order_relaxed);
+}
+
+void setHugePageThreshold(const size_t bytes) {
+    threshold.store(bytes, std::memory_order_relaxed);
+}
+
+size_t allocationCount() {
+    return allocations.load(std::memory_order_relaxed);
+}
+
+void* allocate(const size_t bytes, bool& huge) {
+    huge = false;
+    allocations.fetch_add(1, std::memory_order_relaxed);
+#ifdef __linux__
+    const size_t limit = hugePageThreshold();
+    if ((limit > 0) && (bytes >= limit)) {
+        void* ptr = mapHugePages(roundUp(bytes, HugePageSize));
+        if (ptr != nullptr) {
+            huge = true;
+            return ptr;
+        }
+        // Fall back to a regular allocation below.
+    }
+#endif
+    void* ptr = nullptr;
+    if (posix_memalign(&ptr, Alignment, roundUp(bytes, Alignment)) != 0) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void deallocate(void* ptr, const size_t bytes, const bool huge) {
+    if (ptr == nullptr) {
+        return;
+    }
+#ifdef __linux__
+    if (huge) {
+        munmap(ptr, roundUp(bytes, HugePageSize));
+        return;
+    }
+#endif
+    std::free(ptr);
+}
+
+}  // namespace memory
+
+#endif
@@ -0,0 +1,287 @@
+#ifndef ALIGNED_BUFFER_H
+#define ALIGNED_BUFFER_H
+
+/** \file AlignedBuffer.h Cache-line aligned storage for matrices.
+
+    This file contains the declaration of AlignedBuffer, the storage
+    used by BasicMatrix in place of std::vector.  The buffer behaves
+    like a minimal std::vector (random-access iterators, operator[],
+    data(), resize(), etc.) but its first element is always aligned to
+    a cache line (memory::Alignment bytes), so vector kernels never
+    split a load across cache lines when a row starts at the
+    beginning of a line.
+
+    Very large buffers can optionally be backed by transparent huge
+    pages (Linux only) to reduce TLB misses when streaming through
+    them.  Huge pages are used for buffers of at least
+    memory::hugePageThreshold() bytes.  The threshold is 0 (disabled)
+    by default and can be set via memory::setHugePageThreshold() or
+    via the \c NN_HUGE_PAGES environment variable, which gives the
+    threshold in MiB.
+
+    Copyright (C) 2021 raodm@miamiOH.edu
+*/
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+#include <type_traits>
+
+namespace memory {
+
+/** The alignment (in bytes) of every buffer: one cache line. */
+constexpr size_t Alignment = 64;
+
+/**
+ * Allocates a block of memory aligned to \c Alignment bytes.
+ *
+ * \param[in] bytes The number of bytes to allocate.  Must be > 0.
+ *
+ * \param[out] huge Set to true if the block was backed by huge pages.
+ * This value must be passed back to deallocate().
+ *
+ * \return The allocated block.  Throws std::bad_alloc on failure.
+ */
+void* allocate(size_t bytes, bool& huge);
+
+/**
+ * Releases a block obtained from allocate().
+ *
+ * \param[in] ptr The block to be released (may be nullptr).
+ *
+ * \param[in] bytes The size passed to allocate().
+ *
+ * \param[in] huge The flag returned by allocate().
+ */
+void deallocate(void* ptr, size_t bytes, bool huge);
+
+/**
+ * Returns the size (in bytes) at or above which buffers are backed by
+ * huge pages.  Zero means huge pages are never used.
+ */
+size_t hugePageThreshold();
+
+/**
+ * Sets the size (in bytes) at or above which newly allocated buffers
+ * are backed by huge pages.  Zero disables huge pages.
+ *
+ * \param[in] bytes The new threshold.
+ */
+void setHugePageThreshold(size_t bytes);
+
+/**
+ * Returns the number of blocks allocated by allocate() so far in this
+ * process, i.e., the number of times any matrix storage was
+ * allocated.  Comparing the count before and after a loop shows
+ * whether the loop allocates, e.g., that training with a reused
+ * workspace (see BasicNeuralNet::Workspace) does not.
+ */
+size_t allocationCount();
+
+}  // namespace memory
+
+/**
+ * A contiguous, cache-line aligned array of values with a subset of
+ * the std::vector interface.  Only trivially copyable element types
+ * are supported, since values are moved with memcpy.  Unlike
+ * std::vector, growing the buffer reallocates to exactly the
+ * requested size, as matrices are sized once rather than appended to.
+ *
+ * \tparam T The type of each value in the buffer.
+ */
+template<typename T>
+class AlignedBuffer {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "AlignedBuffer requires trivially copyable values");
+
+public:
+    using value_type      = T;
+    using size_type       = size_t;
+    using difference_type = std::ptrdiff_t;
+    using reference       = T&;
+    using const_reference = const T&;
+    using pointer         = T*;
+    using const_pointer   = const T*;
+    using iterator        = T*;
+    using const_iterator  = const T*;
+
+    /** Creates an empty buffer. */
+    AlignedBuffer() = default;
+
+    /**
+     * Creates a buffer of \c n copies of a given value.
+     *
+     * \param[in] n The number of values in the buffer.
+     *
+     * \param[in] val The value of each entry.
+     */
+    explicit AlignedBuffer(const size_t n, const T& val = T()) {
+        resize(n, val);
+    }
+
+    /**
+     * Creates a buffer holding a copy of (or each value converted
+     * from) the values in the range [first, last).
+     */
+    template<typename InputIt, typename = std::enable_if_t<
+                 !std::is_integral<InputIt>::value>>
+    AlignedBuffer(InputIt first, InputIt last) {
+        reallocate(std::distance(first, last));
+        count = cap;
+        std::copy(first, last, ptr);
+    }
+
+    /** Copy constructor. */
+    AlignedBuffer(const AlignedBuffer& other) {
+        reallocate(other.count);
+        count = other.count;
+        copyValues(other.ptr, count);
+    }
+
+    /** Move constructor.  The other buffer is left empty. */
+    AlignedBuffer(AlignedBuffer&& other) noexcept {
+        swap(other);
+    }
+
+    /** Copy assignment.  Reuses this buffer if it is large enough. */
+    AlignedBuffer& operator=(const AlignedBuffer& other) {
+        if (this != &other) {
+            if (other.count > cap) {
+                reallocate(other.count);
+            }
+            count = other.count;
+            copyValues(other.ptr, count);
+        }
+        return *this;
+    }
+
+    /** Move assignment.  The other buffer receives the old values. */
+    AlignedBuffer& operator=(AlignedBuffer&& other) noexcept {
+        swap(other);
+        return *this;
+    }
+
+    /** Releases the memory held by this buffer. */
+    ~AlignedBuffer() {
+        memory::deallocate(ptr, cap * sizeof(T), huge);
+    }
+
+    size_t size() const { return count; }
+    size_t capacity() const { return cap; }
+    bool empty() const { return count == 0; }
+
+    T* data() { return ptr; }
+    const T* data() const { return ptr; }
+
+    iterator begin() { return ptr; }
+    iterator end() { return ptr + count; }
+    const_iterator begin() const { return ptr; }
+    const_iterator end() const { return ptr + count; }
+    const_iterator cbegin() const { return ptr; }
+    const_iterator cend() const { return ptr + count; }
+
+    T& operator[](const size_t i) { return ptr[i]; }
+    const T& operator[](const size_t i) const { return ptr[i]; }
+
+    T& front() { return ptr[0]; }
+    const T& front() const { return ptr[0]; }
+    T& back() { return ptr[count - 1]; }
+    const T& back() const { return ptr[count - 1]; }
+
+    /** Returns the value at index i, throwing if i is out of range. */
+    T& at(const size_t i) {
+        checkIndex(i);
+        return ptr[i];
+    }
+
+    /** Returns the value at index i, throwing if i is out of range. */
+    const T& at(const size_t i) const {
+        checkIndex(i);
+        return ptr[i];
+    }
+
+    /** Returns true if this buffer is backed by huge pages. */
+    bool hugePages() const { return huge; }
+
+    /**
+     * Changes the number of values in this buffer.  Existing values
+     * are kept, and any new values are set to \c val.
+     *
+     * \param[in] n The new number of values.
+     *
+     * \param[in] val The value of any newly added entries.
+     */
+    void resize(const size_t n, const T& val = T()) {
+        reserve(n);
+        if (n > count) {
+            std::fill(ptr + count, ptr + n, val);
+        }
+        count = n;
+    }
+
+    /** Ensures this buffer can hold n values without reallocating. */
+    void reserve(const size_t n) {
+        if (n > cap) {
+            AlignedBuffer bigger;
+            bigger.reallocate(n);
+            bigger.count = count;
+            bigger.copyValues(ptr, count);
+            swap(bigger);
+        }
+    }
+
+    /** Removes all values, but keeps the memory for reuse. */
+    void clear() { count = 0; }
+
+    /** Exchanges the contents of two buffers without copying. */
+    void swap(AlignedBuffer& other) noexcept {
+        std::swap(ptr, other.ptr);
+        std::swap(count, other.count);
+        std::swap(cap, other.cap);
+        std::swap(huge, other.huge);
+    }
+
+private:
+    // Replaces the memory of this buffer (discarding its values) with
+    // an uninitialized block for n values.
+    void reallocate(const size_t n) {
+        memory::deallocate(ptr, cap * sizeof(T), huge);
+        ptr = nullptr;
+        count = cap = 0;
+        huge = false;
+        if (n > 0) {
+            ptr = static_cast<T*>(memory::allocate(n * sizeof(T), huge));
+            cap = n;
+        }
+    }
+
+    // Copies n values into the start of this buffer.
+    void copyValues(const T* src, const size_t n) {
+        if (n > 0) {
+            std::memcpy(static_cast<void*>(ptr), src, n * sizeof(T));
+        }
+    }
+
+    // Throws std::out_of_range if i is not a valid index.
+    void checkIndex(const size_t i) const {
+        if (i >= count) {
+            throw std::out_of_range("AlignedBuffer index out of range");
+        }
+    }
+
+    /** The (aligned) values in this buffer. */
+    T* ptr = nullptr;
+
+    /** The number of values in this buffer. */
+    size_t count = 0;
+
+    /** The number of values that fit in the memory held by ptr. */
+    size_t cap = 0;
+
+    /** Flag to indicate if ptr was allocated using huge pages. */
+    bool huge = false;
+};
+
+#endif
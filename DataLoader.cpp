@@ -0,0 +1,128 @@
+// Copyright (C) 2021 raodm@miamioh.edu
+
+#ifndef DATA_LOADER_CPP
+#define DATA_LOADER_CPP
+
+#include <algorithm>
+#include <cstdlib>
+#include <utility>
+#include "DataLoader.h"
+
+namespace {
+
+// Returns the value of an environment variable as a number, or a
+// default value if the variable is not set.
+size_t envValue(const char* name, const size_t defValue) {
+    const char* env = std::getenv(name);
+    return (env == nullptr) ? defValue : std::strtoull(env, nullptr, 10);
+}
+
+}  // namespace
+
+DataLoader::Options
+DataLoader::Options::fromEnvironment() {
+    Options options;
+    options.queueDepth  = envValue("NN_LOADER_DEPTH", options.queueDepth);
+    options.workers     = envValue("NN_LOADER_THREADS", options.workers);
+    options.memoryLimit = envValue("NN_LOADER_MEMORY", 0) << 20;
+    return options;
+}
+
+DataLoader::DataLoader(const size_t items, const size_t batchSize,
+                       const size_t inputSize, const size_t outputSize,
+                       Decoder decode, const Options& options) :
+    items(items), batchSize(std::max<size_t>(batchSize, 1)),
+    inputSize(inputSize), outputSize(outputSize), decode(std::move(decode)) {
+    // Limit the number of slots so that the batches in the ring stay
+    // within the memory limit.
+    size_t depth = std::max<size_t>(options.queueDepth, 1);
+    if (options.memoryLimit > 0) {
+        const size_t batchBytes = this->batchSize * sizeof(Val) *
+            (Matrix::paddedPitch(inputSize) + Matrix::paddedPitch(outputSize));
+        depth = std::max<size_t>(1, std::min(depth,
+                                             options.memoryLimit / batchBytes));
+    }
+    slots.resize(depth);
+    const size_t batches = (items + this->batchSize - 1) / this->batchSize;
+    const size_t threads = std::min(std::max<size_t>(options.workers, 1),
+                                    std::max<size_t>(batches, 1));
+    for (size_t i = 0; (i < threads); i++) {
+        workers.emplace_back(&DataLoader::workerLoop, this);
+    }
+}
+
+DataLoader::~DataLoader() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    changed.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void
+DataLoader::workerLoop() {
+    const size_t batches = (items + batchSize - 1) / batchSize;
+    std::unique_lock<std::mutex> guard(lock);
+    while (true) {
+        // Wait until the slot of the next batch has been consumed.
+        changed.wait(guard, [&] {
+                return stopping || (nextBatch >= batches) ||
+                    (nextBatch < consumed + slots.size()); });
+        if (stopping || (nextBatch >= batches)) {
+            return;
+        }
+        const size_t batch = nextBatch++;
+        Slot& slot = slots[batch % slots.size()];
+        guard.unlock();
+
+        // The slot belongs to this thread until it is marked ready, so
+        // the batch is decoded without holding the lock.
+        if ((slot.batch.inputSize() != inputSize) ||
+            (slot.batch.outputSize() != outputSize)) {
+            slot.batch = Dataset(inputSize, outputSize);
+        }
+        slot.batch.clear();
+        const size_t end = std::min(items, (batch + 1) * batchSize);
+        try {
+            slot.batch.reserve(end - batch * batchSize);
+            for (size_t i = batch * batchSize; (i < end); i++) {
+                decode(i, slot.batch);
+            }
+        } catch (...) {
+            slot.error = std::current_exception();
+        }
+
+        guard.lock();
+        slot.ready = true;
+        changed.notify_all();
+    }
+}
+
+bool
+DataLoader::next(Dataset& batch) {
+    std::unique_lock<std::mutex> guard(lock);
+    if (consumed * batchSize >= items) {
+        return false;
+    }
+    Slot& slot = slots[consumed % slots.size()];
+    changed.wait(guard, [&slot] { return slot.ready; });
+    slot.ready = false;
+    consumed++;
+    std::exception_ptr error;
+    std::swap(error, slot.error);
+    if (!error) {
+        // Hand over the batch, and keep the caller's old one for reuse.
+        std::swap(batch, slot.batch);
+    }
+    guard.unlock();
+    changed.notify_all();
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,162 @@
+#ifndef DATA_LOADER_H
+#define DATA_LOADER_H
+
+/** \file DataLoader.h A background loader that prefetches batches.
+
+    This file contains a producer/consumer pipeline that overlaps the
+    reading and decoding of samples (e.g., parsing PGM files) with
+    training.  Background threads decode batches of samples into a
+    bounded ring of slots, while the training thread takes the ready
+    batches in order via DataLoader::next().  Once the ring is full,
+    the trainer only waits if decoding a batch takes longer than
+    training with it.
+
+    The loader threads are dedicated threads rather than tasks on the
+    shared ThreadPool: they mostly wait for I/O, which would otherwise
+    idle pool workers that the matrix operations need.
+
+    The ring depth, the number of loader threads, and a cap on the
+    memory used by the batches are configurable via
+    DataLoader::Options, whose defaults can be overridden with the
+    \c NN_LOADER_DEPTH, \c NN_LOADER_THREADS, and \c NN_LOADER_MEMORY
+    (in MiB) environment variables.
+
+    Copyright (C) 2021 raodm@miamiOH.edu
+*/
+
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Dataset.h"
+
+/**
+ * Loads the items [0, items) as a sequence of batches on background
+ * threads.  Batches are returned by next() in order, so training with
+ * a loader sees the samples in the same order as loading them one by
+ * one would.
+ *
+ * \code
+ * DataLoader loader(fileNames.size(), 64, 784, 10,
+ *                   [&](size_t i, Dataset& batch) {
+ *                       batch.add(loadPGM(fileNames[i]), label(i)); });
+ * for (Dataset batch; loader.next(batch);) {
+ *     net.trainParallel(batch, 16, 4);
+ * }
+ * \endcode
+ */
+class DataLoader {
+public:
+    /**
+     * The callable that decodes item \c i and adds it to the end of a
+     * batch.  It is called concurrently from the loader threads (for
+     * different items and batches).
+     */
+    using Decoder = std::function<void(size_t i, Dataset& batch)>;
+
+    /** The configurable limits of a loader. */
+    struct Options {
+        /** The maximum number of batches that are ready or being
+            decoded at a time. */
+        size_t queueDepth = 4;
+
+        /** The number of loader threads. */
+        size_t workers = 2;
+
+        /** The maximum number of bytes used by the batches that are
+            ready or being decoded (not counting the one held by the
+            caller of next()), or 0 for no limit.  The queue depth is
+            reduced to meet the limit, but is always at least 1. */
+        size_t memoryLimit = 0;
+
+        /** Returns the default options, overridden by the values of
+            any NN_LOADER_* environment variables. */
+        static Options fromEnvironment();
+    };
+
+    /**
+     * Creates a loader and starts decoding the first batches.
+     *
+     * \param[in] items The number of items to load.
+     *
+     * \param[in] batchSize The number of items in each batch.  The
+     * last batch may be smaller.
+     *
+     * \param[in] inputSize The input size of the samples.
+     *
+     * \param[in] outputSize The expected output size of the samples.
+     *
+     * \param[in] decode The callable that adds an item to a batch.
+     *
+     * \param[in] options The limits of this loader.
+     */
+    DataLoader(size_t items, size_t batchSize, size_t inputSize,
+               size_t outputSize, Decoder decode,
+               const Options& options = Options::fromEnvironment());
+
+    /** Stops the loader threads, discarding any unused batches. */
+    ~DataLoader();
+
+    DataLoader(const DataLoader&) = delete;
+    DataLoader& operator=(const DataLoader&) = delete;
+
+    /**
+     * Waits for the next batch and returns it.  The previous contents
+     * of \c batch are recycled by the loader, so passing the same
+     * dataset to every call avoids any allocation once the pipeline
+     * is warm.
+     *
+     * \param[in,out] batch The dataset that receives the next batch.
+     *
+     * \return False (leaving \c batch unchanged) once all the batches
+     * have been returned.  If the decoder threw an exception for an
+     * item in the next batch, that exception is rethrown instead.
+     */
+    bool next(Dataset& batch);
+
+    /** Returns the number of batches that are ready or being decoded
+        at a time, i.e., the queue depth after the memory limit. */
+    size_t depth() const { return slots.size(); }
+
+private:
+    /** A slot of the ring holding one batch. */
+    struct Slot {
+        Dataset batch;
+        bool ready = false;
+        std::exception_ptr error;
+    };
+
+    /** The main loop of each loader thread. */
+    void workerLoop();
+
+    /** The number of items, and of items per batch. */
+    const size_t items, batchSize;
+
+    /** The sample sizes. */
+    const size_t inputSize, outputSize;
+
+    /** The decoder of items. */
+    const Decoder decode;
+
+    /** The ring of slots.  Batch b is decoded into slot b % depth(). */
+    std::vector<Slot> slots;
+
+    /** The index of the next batch to be decoded and to be returned. */
+    size_t nextBatch = 0, consumed = 0;
+
+    /** Flag set when the loader is being destroyed. */
+    bool stopping = false;
+
+    /** Lock protecting the above state, and the condition used to
+        wait for changes to it. */
+    std::mutex lock;
+    std::condition_variable changed;
+
+    /** The loader threads. */
+    std::vector<std::thread> workers;
+};
+
+#endif
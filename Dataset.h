@@ -0,0 +1,147 @@
+#ifndef DATASET_H
+#define DATASET_H
+
+/** \file Dataset.h An in-memory set of training or test samples.
+
+    This file contains a simple container that holds all the inputs
+    and expected outputs of a set of samples in two matrices, with
+    one sample per row.  Storing the samples this way (rather than as
+    a list of column vectors) keeps them in one allocation, lets
+    several threads read them without copying, and lets a range of
+    samples be viewed as one matrix for batched operations.
+
+    Each row is padded to a whole number of cache lines, so every
+    sample starts on an aligned boundary.  A sample is handed to a
+    network as a column view of its row, e.g., net.learn(data.input(i),
+    data.expected(i)), so no values are copied.
+
+    Copyright (C) 2021 raodm@miamiOH.edu
+*/
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include "Matrix.h"
+
+/**
+ * A set of samples, each consisting of an input vector and the
+ * expected output vector for that input.
+ *
+ * \tparam T The type of the values in the inputs and outputs.
+ */
+template<typename T>
+class BasicDataset {
+public:
+    /** A read-only view of a sample or a range of samples. */
+    using ConstView = BasicMatrixView<const T>;
+
+    /**
+     * Creates an empty dataset for samples of the given sizes.
+     *
+     * \param[in] inputSize The number of values in each input.
+     *
+     * \param[in] outputSize The number of values in each expected
+     * output.
+     */
+    BasicDataset(const size_t inputSize = 0, const size_t outputSize = 0) :
+        inSize(inputSize), outSize(outputSize),
+        inputRows(0, inSize, 0, BasicMatrix<T>::paddedPitch(inSize)),
+        expectedRows(0, outSize, 0, BasicMatrix<T>::paddedPitch(outSize)) {}
+
+    /** Returns the number of samples in this dataset. */
+    size_t size() const { return inputRows.height(); }
+
+    /** Returns true if this dataset has no samples. */
+    bool empty() const { return size() == 0; }
+
+    /** Returns the number of values in each input. */
+    size_t inputSize() const { return inSize; }
+
+    /** Returns the number of values in each expected output. */
+    size_t outputSize() const { return outSize; }
+
+    /** Ensures that n samples can be stored without reallocating. */
+    void reserve(const size_t n) {
+        inputRows.reserve(n * inputRows.pitch());
+        expectedRows.reserve(n * expectedRows.pitch());
+    }
+
+    /** Removes all samples, but keeps the memory for reuse. */
+    void clear() {
+        inputRows.reshape(0, inSize, inputRows.pitch());
+        expectedRows.reshape(0, outSize, expectedRows.pitch());
+    }
+
+    /**
+     * Adds a sample to the end of this dataset.  The values of each
+     * view are copied in row-major order, so a column vector and a
+     * row vector of the same length add the same sample.
+     *
+     * \param[in] input The input values.  It must have inputSize()
+     * values.
+     *
+     * \param[in] expected The expected output values.  It must have
+     * outputSize() values.
+     */
+    void add(ConstView input, ConstView expected) {
+        const size_t n = size();
+        if (n == capacity()) {
+            reserve(std::max<size_t>(2 * n, 16));
+        }
+        append(inputRows, inSize, input);
+        append(expectedRows, outSize, expected);
+    }
+
+    /** Returns a column view of the input of sample i. */
+    ConstView input(const size_t i) const {
+        return inputRows.row(i).asColumn();
+    }
+
+    /** Returns a column view of the expected output of sample i. */
+    ConstView expected(const size_t i) const {
+        return expectedRows.row(i).asColumn();
+    }
+
+    /** Returns the inputs of samples [begin, end), one per row. */
+    ConstView inputBatch(const size_t begin, const size_t end) const {
+        return inputRows.rows(begin, end);
+    }
+
+    /** Returns the expected outputs of samples [begin, end). */
+    ConstView expectedBatch(const size_t begin, const size_t end) const {
+        return expectedRows.rows(begin, end);
+    }
+
+private:
+    /** Returns the number of samples that fit without reallocating. */
+    size_t capacity() const {
+        const size_t pitch = std::max<size_t>(inputRows.pitch(), 1);
+        return inputRows.capacity() / pitch;
+    }
+
+    /** Adds the values of a view as a new row of a matrix. */
+    static void append(BasicMatrix<T>& rows, const size_t cols,
+                       ConstView values) {
+        assert(values.height() * values.width() == cols);
+        const size_t r = rows.height();
+        rows.reshape(r + 1, cols, rows.pitch());
+        T* dest = rows.data() + r * rows.pitch();
+        for (size_t i = 0; (i < values.height()) && (cols > 0); i++) {
+            dest = std::copy_n(&values(i, 0), values.width(), dest);
+        }
+    }
+
+    /** The number of values in each input and expected output. */
+    size_t inSize, outSize;
+
+    /** The inputs of the samples, one per row. */
+    BasicMatrix<T> inputRows;
+
+    /** The expected outputs of the samples, one per row. */
+    BasicMatrix<T> expectedRows;
+};
+
+/** The default dataset, which holds Val values. */
+using Dataset = BasicDataset<Val>;
+
+#endif
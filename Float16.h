@@ -0,0 +1,185 @@
+#ifndef FLOAT16_H
+#define FLOAT16_H
+
+/** \file Float16.h Reduced-precision storage types.
+
+    This file contains two 16-bit floating-point storage types that
+    can be used as the element type of a BasicMatrix to halve the
+    memory footprint of large, read-mostly matrices such as the
+    weights of a neural network:
+
+    <ul>
+    <li>BFloat16 -- the upper 16 bits of an IEEE float.  It keeps the
+    full exponent range of float with an 8-bit significand.</li>
+
+    <li>Float16 -- IEEE 754 binary16 (half precision), with a 5-bit
+    exponent and an 11-bit significand.</li>
+    </ul>
+
+    Both types are storage formats only: they convert implicitly to
+    and from float (rounding to nearest-even), and all arithmetic on
+    them is carried out in float.  The Accumulator trait maps each
+    element type to the type used for sums of products involving it.
+
+    Copyright (C) 2021 raodm@miamiOH.edu
+*/
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+/** A bfloat16 value stored as the upper half of an IEEE float. */
+struct BFloat16 {
+    /** The raw bits of this value. */
+    uint16_t bits = 0;
+
+    /** Creates a zero value. */
+    BFloat16() = default;
+
+    /** Converts a float to bfloat16, rounding to nearest-even. */
+    BFloat16(const float val) {
+        uint32_t raw;
+        std::memcpy(&raw, &val, sizeof(raw));
+        if ((raw & 0x7fffffffu) > 0x7f800000u) {
+            bits = 0x7fc0;  // Quiet NaN.
+        } else {
+            raw += 0x7fffu + ((raw >> 16) & 1u);
+            bits = static_cast<uint16_t>(raw >> 16);
+        }
+    }
+
+    /** Converts this value to float (exact). */
+    operator float() const {
+        const uint32_t raw = static_cast<uint32_t>(bits) << 16;
+        float val;
+        std::memcpy(&val, &raw, sizeof(val));
+        return val;
+    }
+};
+
+/** An IEEE 754 binary16 (half precision) value. */
+struct Float16 {
+    /** The raw bits of this value. */
+    uint16_t bits = 0;
+
+    /** Creates a zero value. */
+    Float16() = default;
+
+    /** Converts a float to half precision, rounding to nearest-even.
+        Values beyond the half range become infinity. */
+    Float16(const float val) {
+        uint32_t raw;
+        std::memcpy(&raw, &val, sizeof(raw));
+        const uint32_t sign = (raw >> 16) & 0x8000u;
+        const uint32_t absv = raw & 0x7fffffffu;
+        if (absv > 0x7f800000u) {
+            bits = static_cast<uint16_t>(sign | 0x7e00u);  // NaN.
+        } else if (absv >= 0x477ff000u) {
+            bits = static_cast<uint16_t>(sign | 0x7c00u);  // Overflow.
+        } else if (absv < 0x38800000u) {
+            // Subnormal (or zero) in half precision: shift the
+            // significand, with the implicit bit, into place.
+            const int shift = 126 - static_cast<int>(absv >> 23);
+            if (shift > 24) {
+                bits = static_cast<uint16_t>(sign);
+            } else {
+                const uint32_t mant = (absv & 0x7fffffu) | 0x800000u;
+                uint32_t half = mant >> shift;
+                const uint32_t rem = mant & ((1u << shift) - 1u);
+                const uint32_t mid = 1u << (shift - 1);
+                if ((rem > mid) || ((rem == mid) && (half & 1u))) {
+                    half++;
+                }
+                bits = static_cast<uint16_t>(sign | half);
+            }
+        } else {
+            // Normal: re-bias the exponent and round the significand.
+            uint32_t half = ((absv >> 13) - (112u << 10));
+            const uint32_t rem = absv & 0x1fffu;
+            if ((rem > 0x1000u) || ((rem == 0x1000u) && (half & 1u))) {
+                half++;
+            }
+            bits = static_cast<uint16_t>(sign | half);
+        }
+    }
+
+    /** Converts this value to float (exact). */
+    operator float() const {
+        const uint32_t sign = static_cast<uint32_t>(bits & 0x8000u) << 16;
+        const uint32_t expo = (bits >> 10) & 0x1fu;
+        uint32_t mant = bits & 0x3ffu;
+        uint32_t raw;
+        if (expo == 0x1fu) {
+            raw = sign | 0x7f800000u | (mant << 13);  // Inf or NaN.
+        } else if (expo != 0) {
+            raw = sign | ((expo + 112u) << 23) | (mant << 13);
+        } else if (mant == 0) {
+            raw = sign;  // Signed zero.
+        } else {
+            // Subnormal half: normalize it for float.
+            uint32_t e = 113;
+            while ((mant & 0x400u) == 0) {
+                mant <<= 1;
+                e--;
+            }
+            raw = sign | (e << 23) | ((mant & 0x3ffu) << 13);
+        }
+        float val;
+        std::memcpy(&val, &raw, sizeof(val));
+        return val;
+    }
+};
+
+/** Stream insertion operator that prints the value as a float. */
+inline std::ostream& operator<<(std::ostream& os, const BFloat16 val) {
+    return os << static_cast<float>(val);
+}
+
+/** Stream extraction operator that reads the value as a float. */
+inline std::istream& operator>>(std::istream& is, BFloat16& val) {
+    float f;
+    if (is >> f) {
+        val = BFloat16(f);
+    }
+    return is;
+}
+
+/** Stream insertion operator that prints the value as a float. */
+inline std::ostream& operator<<(std::ostream& os, const Float16 val) {
+    return os << static_cast<float>(val);
+}
+
+/** Stream extraction operator that reads the value as a float. */
+inline std::istream& operator>>(std::istream& is, Float16& val) {
+    float f;
+    if (is >> f) {
+        val = Float16(f);
+    }
+    return is;
+}
+
+/** Trait that gives the type used to accumulate sums of products of
+    a given element type.  Reduced-precision types accumulate in
+    float; all other types accumulate in themselves. */
+template<typename T>
+struct Accumulator {
+    using type = T;
+};
+
+/** bfloat16 values are accumulated in float. */
+template<>
+struct Accumulator<BFloat16> {
+    using type = float;
+};
+
+/** Half-precision values are accumulated in float. */
+template<>
+struct Accumulator<Float16> {
+    using type = float;
+};
+
+/** Shortcut to the accumulation type for a given element type. */
+template<typename T>
+using AccumT = typename Accumulator<T>::type;
+
+#endif
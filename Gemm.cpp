@@ -0,0 +1,220 @@
+// Copyright (C) 2021 raodm@miamioh.edu
+
+#ifndef GEMM_CPP
+#define GEMM_CPP
+
+#include <algorithm>
+#include <vector>
+#include "Float16.h"
+#include "Gemm.h"
+#include "Simd.h"
+
+namespace gemm {
+
+namespace {
+
+// Packs an mc x kc block of A into consecutive MR-row slivers.  Within
+// each sliver the MR values of a column are stored contiguously so
+// that the micro-kernel reads A with unit stride.  Rows past the end
+// of A are zero-padded so the micro-kernel never needs edge checks.
+template<typename T, typename TA>
+void packA(const size_t mc, const size_t kc, const TA* a,
+           const size_t rsA, const size_t csA, T* buf) {
+    for (size_t i = 0; (i < mc); i += MR) {
+        const size_t mr = std::min(MR, mc - i);
+        for (size_t p = 0; (p < kc); p++) {
+            const TA* src = a + i * rsA + p * csA;
+            for (size_t ii = 0; (ii < mr); ii++) {
+                *buf++ = static_cast<T>(src[ii * rsA]);
+            }
+            for (size_t ii = mr; (ii < MR); ii++) {
+                *buf++ = T(0);
+            }
+        }
+    }
+}
+
+// Packs a kc x nc panel of B into consecutive NR-column slivers.
+// Within each sliver the NR values of a row are stored contiguously.
+// Columns past the end of B are zero-padded.
+template<typename T>
+void packB(const size_t kc, const size_t nc, const T* b,
+           const size_t rsB, const size_t csB, T* buf) {
+    for (size_t j = 0; (j < nc); j += NR) {
+        const size_t nr = std::min(NR, nc - j);
+        for (size_t p = 0; (p < kc); p++) {
+            const T* src = b + p * rsB + j * csB;
+            for (size_t jj = 0; (jj < nr); jj++) {
+                *buf++ = src[jj * csB];
+            }
+            for (size_t jj = nr; (jj < NR); jj++) {
+                *buf++ = T(0);
+            }
+        }
+    }
+}
+
+// Number of reduced-precision values widened at a time by the
+// matrix-vector kernels.
+constexpr size_t WidenBlock = 256;
+
+// Number of rows of a dense layer computed before their activations.
+constexpr size_t DenseBlock = 64;
+
+// Returns the inner product of a row of A with x.  Rows stored in the
+// accumulation type are handed straight to the vector kernel.
+template<typename T>
+T rowDot(const T* row, const T* x, const size_t n) {
+    return simd::kernels<T>().dot(row, x, n);
+}
+
+// Overload for reduced-precision rows, which are widened a block at a
+// time into a stack buffer before using the vector kernel.
+template<typename T, typename TA>
+T rowDot(const TA* row, const T* x, const size_t n) {
+    const auto dot = simd::kernels<T>().dot;
+    T wide[WidenBlock], sum = 0;
+    for (size_t j = 0; (j < n); j += WidenBlock) {
+        const size_t len = std::min(WidenBlock, n - j);
+        std::copy_n(row + j, len, wide);
+        sum += dot(wide, x + j, len);
+    }
+    return sum;
+}
+
+// Computes y += alpha * row, where row is a row of A.
+template<typename T>
+void rowAxpy(const T alpha, const T* row, T* y, const size_t n) {
+    simd::kernels<T>().axpy(alpha, row, y, n);
+}
+
+// Overload for reduced-precision rows (see rowDot).
+template<typename T, typename TA>
+void rowAxpy(const T alpha, const TA* row, T* y, const size_t n) {
+    const auto axpy = simd::kernels<T>().axpy;
+    T wide[WidenBlock];
+    for (size_t j = 0; (j < n); j += WidenBlock) {
+        const size_t len = std::min(WidenBlock, n - j);
+        std::copy_n(row + j, len, wide);
+        axpy(alpha, wide, y + j, len);
+    }
+}
+
+}  // namespace
+
+template<typename T, typename TA>
+void gemm(const size_t m, const size_t n, const size_t k,
+          const TA* a, const size_t rsA, const size_t csA,
+          const T* b, const size_t rsB, const size_t csB,
+          T* c, const size_t ldc) {
+    if ((m == 0) || (n == 0)) {
+        return;  // Nothing to compute.
+    }
+    if (k == 0) {
+        // An empty inner dimension yields a zero matrix.
+        for (size_t i = 0; (i < m); i++) {
+            std::fill_n(c + i * ldc, n, T(0));
+        }
+        return;
+    }
+    // The packing buffers are reused across calls to avoid allocating
+    // on every product.  They are thread-local so that concurrent
+    // products do not share scratch space.
+    thread_local std::vector<T> bufA, bufB;
+    const size_t ncMax = std::min(NC, (n + NR - 1) / NR * NR);
+    const size_t kcMax = std::min(KC, k);
+    const size_t mcMax = std::min(MC, (m + MR - 1) / MR * MR);
+    bufA.resize(std::max(bufA.size(), mcMax * kcMax));
+    bufB.resize(std::max(bufB.size(), kcMax * ncMax));
+    // The micro-kernel variant best suited to this host.
+    const auto microKernel = simd::kernels<T>().gemmMicroKernel;
+
+    for (size_t jc = 0; (jc < n); jc += NC) {
+        const size_t nc = std::min(NC, n - jc);
+        for (size_t pc = 0; (pc < k); pc += KC) {
+            const size_t kc = std::min(KC, k - pc);
+            packB(kc, nc, b + pc * rsB + jc * csB, rsB, csB, bufB.data());
+            for (size_t ic = 0; (ic < m); ic += MC) {
+                const size_t mc = std::min(MC, m - ic);
+                packA(mc, kc, a + ic * rsA + pc * csA, rsA, csA, bufA.data());
+                // Sweep the register tiles over the packed block.
+                for (size_t jr = 0; (jr < nc); jr += NR) {
+                    const T* bp = bufB.data() + jr * kc;
+                    for (size_t ir = 0; (ir < mc); ir += MR) {
+                        microKernel(kc, bufA.data() + ir * kc, bp,
+                                    c + (ic + ir) * ldc + jc + jr, ldc,
+                                    std::min(MR, mc - ir),
+                                    std::min(NR, nc - jr), pc > 0);
+                    }
+                }
+            }
+        }
+    }
+}
+
+template<typename T, typename TA>
+void gemv(const size_t m, const size_t n, const TA* a, const size_t lda,
+          const T* x, T* y) {
+    for (size_t i = 0; (i < m); i++) {
+        y[i] = rowDot(a + i * lda, x, n);
+    }
+}
+
+template<typename T, typename TA>
+void dense(const size_t m, const size_t n, const TA* a, const size_t lda,
+           const T* x, const T* bias, const simd::ActivationFn<T> act,
+           T* z, T* out) {
+    // Without z, the weighted inputs are kept in out until they are
+    // replaced by their activations.
+    T* const dst = (z != nullptr) ? z : out;
+    for (size_t i0 = 0; (i0 < m); i0 += DenseBlock) {
+        const size_t rows = std::min(DenseBlock, m - i0);
+        for (size_t i = i0; (i < i0 + rows); i++) {
+            dst[i] = rowDot(a + i * lda, x, n) + bias[i];
+        }
+        act(dst + i0, out + i0, rows);
+    }
+}
+
+template<typename T, typename TA>
+void gemvT(const size_t m, const size_t n, const TA* a, const size_t lda,
+           const T* x, T* y) {
+    std::fill_n(y, n, T(0));
+    for (size_t i = 0; (i < m); i++) {
+        rowAxpy(x[i], a + i * lda, y, n);
+    }
+}
+
+template<typename T, typename TX>
+void ger(const size_t m, const size_t n, const TX* x, const T* y, T* a,
+         const size_t lda) {
+    const auto scale = simd::kernels<T>().scale;
+    for (size_t i = 0; (i < m); i++) {
+        scale(y, static_cast<T>(x[i]), a + i * lda, n);
+    }
+}
+
+// Explicit instantiations for the supported combinations of
+// accumulation type (T) and storage type of the left operand (TA).
+#define NN_INSTANTIATE_GEMM(T, TA)                                      \
+    template void gemm<T, TA>(size_t, size_t, size_t, const TA*, size_t, \
+                              size_t, const T*, size_t, size_t, T*,     \
+                              size_t);                                  \
+    template void gemv<T, TA>(size_t, size_t, const TA*, size_t,        \
+                              const T*, T*);                            \
+    template void dense<T, TA>(size_t, size_t, const TA*, size_t,       \
+                               const T*, const T*,                      \
+                               simd::ActivationFn<T>, T*, T*);          \
+    template void gemvT<T, TA>(size_t, size_t, const TA*, size_t,       \
+                               const T*, T*);                           \
+    template void ger<T, TA>(size_t, size_t, const TA*, const T*, T*,   \
+                             size_t);
+
+NN_INSTANTIATE_GEMM(float, float)
+NN_INSTANTIATE_GEMM(double, double)
+NN_INSTANTIATE_GEMM(float, BFloat16)
+NN_INSTANTIATE_GEMM(float, Float16)
+
+}  // namespace gemm
+
+#endif
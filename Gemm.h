@@ -0,0 +1,206 @@
+#ifndef GEMM_H
+#define GEMM_H
+
+/** \file Gemm.h A cache-blocked general matrix-multiply engine.
+
+    This file contains the declaration of the GEMM kernel that backs
+    Matrix::dot.  The implementation follows the classic
+    Goto/BLIS-style structure:
+
+    <ul>
+    <li>The columns of B are split into panels of width \c NC and the
+    shared dimension into slabs of depth \c KC so that a packed KC x
+    NC panel of B stays resident in the L2/L3 cache.</li>
+
+    <li>The rows of A are split into blocks of height \c MC so that a
+    packed MC x KC block of A stays resident in the L2 cache.</li>
+
+    <li>The packed panels are consumed by a register-tiled
+    micro-kernel that computes an MR x NR tile of C entirely in
+    registers, streaming contiguous slivers of A and B out of L1.
+    The micro-kernel is chosen at runtime from the table in Simd.h.</li>
+    </ul>
+
+    Operands are described by a pointer plus a row-stride and a
+    column-stride so that row-major, column-major, and transposed
+    operands are all handled by the same packing routines without
+    making copies.
+
+    The left operand A may be stored in a reduced-precision type (see
+    Float16.h).  Its values are widened to the accumulation type T
+    while being packed (or a block at a time for the matrix-vector
+    kernels), so all arithmetic is carried out in T.
+
+    Because the blocked kernel sums partial products in a different
+    order than a naive triple loop, results may differ from the naive
+    product by rounding only.  Each entry of C is within
+    <tt>k * eps * sum(|a_ip| * |b_pj|)</tt> of the exact product,
+    where \c eps is the machine epsilon of the element type -- the
+    same bound as the naive loop.
+
+    Copyright (C) 2021 raodm@miamiOH.edu
+*/
+
+#include <cstddef>
+#include "Simd.h"
+
+namespace gemm {
+
+/** Number of rows of A packed into one L2-resident block. */
+constexpr size_t MC = 96;
+
+/** Depth of the shared dimension packed per block (L1 resident). */
+constexpr size_t KC = 256;
+
+/** Number of columns of B packed into one L3-resident panel. */
+constexpr size_t NC = 1024;
+
+/** Height of the register tile computed by the micro-kernel. */
+constexpr size_t MR = 4;
+
+/** Width of the register tile computed by the micro-kernel. */
+constexpr size_t NR = 8;
+
+/**
+ * Computes C = A * B, where A is an m x k matrix, B is a k x n
+ * matrix, and C is a row-major m x n matrix.  Any previous contents
+ * of C are overwritten.
+ *
+ * \param[in] m The number of rows in A and C.
+ *
+ * \param[in] n The number of columns in B and C.
+ *
+ * \param[in] k The number of columns in A and rows in B.
+ *
+ * \param[in] a Pointer to the first element of A.
+ *
+ * \param[in] rsA The distance (in elements) between consecutive rows
+ * of A.
+ *
+ * \param[in] csA The distance (in elements) between consecutive
+ * columns of A.
+ *
+ * \param[in] b Pointer to the first element of B.
+ *
+ * \param[in] rsB The distance (in elements) between consecutive rows
+ * of B.
+ *
+ * \param[in] csB The distance (in elements) between consecutive
+ * columns of B.
+ *
+ * \param[out] c Pointer to the first element of C.
+ *
+ * \param[in] ldc The distance (in elements) between consecutive rows
+ * of C.
+ */
+template<typename T, typename TA = T>
+void gemm(size_t m, size_t n, size_t k,
+          const TA* a, size_t rsA, size_t csA,
+          const T* b, size_t rsB, size_t csB,
+          T* c, size_t ldc);
+
+/**
+ * Computes the matrix-vector product y = A * x, where A is a
+ * row-major m x n matrix and x is a contiguous vector of n values.
+ * Each row of A is streamed contiguously through the vectorized inner
+ * product kernel from Simd.h, which keeps several independent
+ * accumulators in flight.
+ *
+ * \param[in] m The number of rows in A and entries in y.
+ *
+ * \param[in] n The number of columns in A and entries in x.
+ *
+ * \param[in] a Pointer to the first element of A.
+ *
+ * \param[in] lda The distance (in elements) between consecutive rows
+ * of A.
+ *
+ * \param[in] x Pointer to the first element of x.
+ *
+ * \param[out] y Pointer to the first element of y.
+ */
+template<typename T, typename TA = T>
+void gemv(size_t m, size_t n, const TA* a, size_t lda, const T* x, T* y);
+
+/**
+ * Computes a dense (fully connected) layer, z = A * x + bias and
+ * out = act(z), in a single sweep over the rows of A.  The rows are
+ * processed in small blocks whose entries of z are passed to the
+ * (vectorized) activation function while they are still in the L1
+ * cache, so there are no separate passes over the results for the
+ * bias and the activation.
+ *
+ * \param[in] m The number of rows in A and entries in the results.
+ *
+ * \param[in] n The number of columns in A and entries in x.
+ *
+ * \param[in] a Pointer to the first element of A.
+ *
+ * \param[in] lda The distance (in elements) between consecutive rows
+ * of A.
+ *
+ * \param[in] x Pointer to the first element of x.
+ *
+ * \param[in] bias Pointer to the first of the m biases.
+ *
+ * \param[in] act The activation function, e.g., from
+ * simd::activations().
+ *
+ * \param[out] z Pointer to the first element of z, or nullptr if z
+ * is not needed.
+ *
+ * \param[out] out Pointer to the first element of the activations.
+ * It may be the same as \c z but must not overlap x or the bias.
+ */
+template<typename T, typename TA = T>
+void dense(size_t m, size_t n, const TA* a, size_t lda, const T* x,
+           const T* bias, simd::ActivationFn<T> act, T* z, T* out);
+
+/**
+ * Computes the transposed matrix-vector product y = A' * x, where A
+ * is a row-major m x n matrix and x is a contiguous vector of m
+ * values.  Rather than walking the columns of A, this method streams
+ * the rows of A contiguously and accumulates each scaled row into y.
+ * This is also the product of a 1 x m row vector and A.
+ *
+ * \param[in] m The number of rows in A and entries in x.
+ *
+ * \param[in] n The number of columns in A and entries in y.
+ *
+ * \param[in] a Pointer to the first element of A.
+ *
+ * \param[in] lda The distance (in elements) between consecutive rows
+ * of A.
+ *
+ * \param[in] x Pointer to the first element of x.
+ *
+ * \param[out] y Pointer to the first element of y.
+ */
+template<typename T, typename TA = T>
+void gemvT(size_t m, size_t n, const TA* a, size_t lda, const T* x, T* y);
+
+/**
+ * Computes the outer product A = x * y', where x is a contiguous
+ * vector of m values, y is a contiguous vector of n values, and A is
+ * a row-major m x n matrix.  Any previous contents of A are
+ * overwritten.
+ *
+ * \param[in] m The number of entries in x and rows in A.
+ *
+ * \param[in] n The number of entries in y and columns in A.
+ *
+ * \param[in] x Pointer to the first element of x.
+ *
+ * \param[in] y Pointer to the first element of y.
+ *
+ * \param[out] a Pointer to the first element of A.
+ *
+ * \param[in] lda The distance (in elements) between consecutive rows
+ * of A.
+ */
+template<typename T, typename TX = T>
+void ger(size_t m, size_t n, const TX* x, const T* y, T* a, size_t lda);
+
+}  // namespace gemm
+
+#endif
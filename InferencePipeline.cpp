@@ -0,0 +1,122 @@
+// Copyright (C) 2021 raodm@miamioh.edu
+
+#ifndef INFERENCE_PIPELINE_CPP
+#define INFERENCE_PIPELINE_CPP
+
+#include <algorithm>
+#include <utility>
+#include "InferencePipeline.h"
+
+template<typename T, typename W>
+BasicInferencePipeline<T, W>::BasicInferencePipeline(const Net& net,
+                                                     size_t stages,
+                                                     const size_t capacity) :
+    net(net) {
+    const size_t layers = net.layerCount();
+    stages = (stages == 0) ? layers : std::min(stages, layers);
+    stages = std::max<size_t>(stages, 1);
+
+    // Split the layers into stages of about the same cost, cutting
+    // before the layer at which the cumulative cost reaches the next
+    // multiple of total / stages.  Each stage gets at least one layer.
+    std::vector<size_t> cost(layers + 1, 0);
+    for (size_t lyr = 0; (lyr < layers); lyr++) {
+        cost[lyr + 1] = cost[lyr] + net.weightCount(lyr);
+    }
+    firstLayer.push_back(0);
+    for (size_t s = 1; (s < stages); s++) {
+        size_t cut = firstLayer.back() + 1;
+        while ((cut < layers - (stages - s)) &&
+               (cost[cut] * stages < cost[layers] * s)) {
+            cut++;
+        }
+        firstLayer.push_back(cut);
+    }
+    firstLayer.push_back(layers);
+
+    for (size_t s = 0; (s <= stages); s++) {
+        queues.emplace_back(new SpscQueue<Item>(std::max<size_t>(capacity, 1)));
+    }
+    for (size_t s = 0; (s < stages); s++) {
+        threads.emplace_back(&BasicInferencePipeline::stageLoop, this, s);
+    }
+}
+
+template<typename T, typename W>
+BasicInferencePipeline<T, W>::~BasicInferencePipeline() {
+    if (!closed) {
+        // Send the end marker, draining outputs so that the stages
+        // can make room for it.
+        Item end, unused;
+        end.last = true;
+        while (!queues.front()->tryPush(end)) {
+            queues.back()->tryPop(unused);
+            std::this_thread::yield();
+        }
+        closed = true;
+    }
+    for (Vector unused; pop(unused);) {}
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+template<typename T, typename W>
+void
+BasicInferencePipeline<T, W>::push(ConstView input) {
+    Item item;
+    item.value = input;
+    queues.front()->push(std::move(item));
+}
+
+template<typename T, typename W>
+void
+BasicInferencePipeline<T, W>::close() {
+    if (!closed) {
+        Item end;
+        end.last = true;
+        queues.front()->push(std::move(end));
+        closed = true;
+    }
+}
+
+template<typename T, typename W>
+bool
+BasicInferencePipeline<T, W>::pop(Vector& output) {
+    if (finished) {
+        return false;
+    }
+    Item item = queues.back()->pop();
+    if (item.last) {
+        finished = true;
+        return false;
+    }
+    output = std::move(item.value);
+    return true;
+}
+
+template<typename T, typename W>
+void
+BasicInferencePipeline<T, W>::stageLoop(const size_t stage) {
+    SpscQueue<Item>& in = *queues[stage];
+    SpscQueue<Item>& out = *queues[stage + 1];
+    for (Item item = in.pop(); !item.last; item = in.pop()) {
+        for (size_t lyr = firstLayer[stage]; (lyr < firstLayer[stage + 1]);
+             lyr++) {
+            item.value = net.feedForward(lyr, item.value);
+        }
+        out.push(std::move(item));
+    }
+    // Pass the end marker on to the next stage.
+    Item end;
+    end.last = true;
+    out.push(std::move(end));
+}
+
+// Explicit instantiations for the supported neural networks.
+template class BasicInferencePipeline<double>;
+template class BasicInferencePipeline<float>;
+template class BasicInferencePipeline<float, BFloat16>;
+template class BasicInferencePipeline<float, Float16>;
+
+#endif
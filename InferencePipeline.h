@@ -0,0 +1,147 @@
+#ifndef INFERENCE_PIPELINE_H
+#define INFERENCE_PIPELINE_H
+
+/** \file InferencePipeline.h Layer-pipelined streaming inference.
+
+    This file contains a pipeline that classifies a stream of inputs
+    with a neural network whose layers are split into stages, each run
+    by its own thread.  Consecutive stages are connected by lock-free
+    single-producer, single-consumer queues (see SpscQueue.h), so
+    while stage 1 computes the later layers for input k, stage 0 is
+    already computing the first layers for input k + 1.  For deep
+    networks this raises the sustained throughput of a stream of
+    single inputs without the latency of waiting to fill a batch (see
+    BasicNeuralNet::classifyBatch for batched inference).
+
+    The stage threads are dedicated threads rather than tasks on the
+    shared ThreadPool, since each runs for the life of the pipeline.
+    Idle stages yield their thread while they wait for input, so a
+    pipeline is meant for streams that keep it busy.
+
+    Copyright (C) 2021 raodm@miamiOH.edu
+*/
+
+#include <memory>
+#include <thread>
+#include <vector>
+#include "NeuralNet.h"
+#include "SpscQueue.h"
+
+/**
+ * Classifies a stream of inputs with a pipeline of layer stages.
+ * Exactly one thread may submit inputs (push() and close()) and
+ * exactly one thread may receive the outputs (pop()), which come out
+ * in the order the inputs went in.  Each output is identical to the
+ * result of BasicNeuralNet::classify() for its input.
+ *
+ * \code
+ * InferencePipeline pipeline(net);
+ * std::thread producer([&] {
+ *     for (const auto& img : images) { pipeline.push(img); }
+ *     pipeline.close();
+ * });
+ * for (Matrix out; pipeline.pop(out);) { use(out); }
+ * producer.join();
+ * \endcode
+ *
+ * \tparam T The compute type of the network.
+ *
+ * \tparam W The weight storage type of the network.
+ */
+template<typename T, typename W = T>
+class BasicInferencePipeline {
+public:
+    /** The network type. */
+    using Net = BasicNeuralNet<T, W>;
+
+    /** The type of inputs and outputs. */
+    using Vector = typename Net::Vector;
+
+    /** A read-only view of an input. */
+    using ConstView = typename Net::ConstView;
+
+    /**
+     * Creates a pipeline and starts its stage threads.
+     *
+     * \param[in] net The network used for classification.  It must
+     * not be changed or destroyed while the pipeline exists.
+     *
+     * \param[in] stages The number of stages (and threads).  The
+     * layers are split into contiguous groups of about the same cost.
+     * Zero (the default) means one stage per layer; values above the
+     * number of layers are reduced to it.
+     *
+     * \param[in] capacity The capacity of each queue between stages.
+     */
+    explicit BasicInferencePipeline(const Net& net, size_t stages = 0,
+                                    size_t capacity = 64);
+
+    /** Closes the pipeline (if needed), discards any outputs that
+        were not popped, and joins the stage threads.  The producer
+        and consumer threads must be done using the pipeline. */
+    ~BasicInferencePipeline();
+
+    BasicInferencePipeline(const BasicInferencePipeline&) = delete;
+    BasicInferencePipeline& operator=(const BasicInferencePipeline&) =
+        delete;
+
+    /**
+     * Submits an input to be classified, waiting while the first
+     * queue is full.
+     *
+     * \param[in] input The input, which is copied.
+     */
+    void push(ConstView input);
+
+    /** Indicates that no more inputs will be pushed.  Once the
+        pending outputs have been popped, pop() returns false. */
+    void close();
+
+    /**
+     * Waits for the output for the next input.
+     *
+     * \param[out] output The output of the network for the input.
+     *
+     * \return False (without waiting) once the pipeline was closed
+     * and all the outputs have been popped.
+     */
+    bool pop(Vector& output);
+
+    /** Returns the number of stages in this pipeline. */
+    size_t stageCount() const { return threads.size(); }
+
+private:
+    /** A value passed between stages, or the end-of-stream marker. */
+    struct Item {
+        Vector value;
+        bool last = false;
+    };
+
+    /** The main loop of the thread running a given stage. */
+    void stageLoop(size_t stage);
+
+    /** The network used for classification. */
+    const Net& net;
+
+    /** Stage s computes layers [firstLayer[s], firstLayer[s + 1]). */
+    std::vector<size_t> firstLayer;
+
+    /** Queue s feeds stage s; the last queue holds the outputs. */
+    std::vector<std::unique_ptr<SpscQueue<Item>>> queues;
+
+    /** The stage threads. */
+    std::vector<std::thread> threads;
+
+    /** Flags set by close() and when pop() has seen the end. */
+    bool closed = false, finished = false;
+};
+
+/** The pipeline for the default neural network. */
+using InferencePipeline = BasicInferencePipeline<Val>;
+
+extern template class BasicInferencePipeline<double>;
+extern template class BasicInferencePipeline<float>;
+extern template class BasicInferencePipeline<float, BFloat16>;
+extern template class BasicInferencePipeline<float, Float16>;
+
+#endif
@@ -6,41 +6,330 @@
 #include <cassert>
 #include <vector>
 #include <array>
+#include <algorithm>
 #include "Matrix.h"
+#include "Gemm.h"
+#include "ThreadPool.h"
 
-Matrix::Matrix(const size_t row, const size_t col, const Val initVal)
-        : std::vector<Val>(row * col, initVal) {
+namespace {
+
+// Edge length of the square blocks used by the transpose.  Two
+// 32 x 32 blocks of doubles (16 KB) fit comfortably in the L1 cache.
+constexpr size_t TransposeBlock = 32;
+
+// Number of elements above which operations are split across threads.
+constexpr size_t ParallelThreshold = 1 << 18;
+
+// Number of multiply-adds above which a product is split across
+// threads.  Below this the packing and scheduling overheads dominate.
+constexpr size_t ParallelProductThreshold = 1 << 21;
+
+// Number of chunks created per thread so that idle threads can steal
+// work from slower ones.
+constexpr size_t ChunksPerThread = 4;
+
+// Minimum width of the tiles of a product computed by one task.
+constexpr size_t GemmTileCols = 64;
+
+// Runs body(begin, end) over [0, loopSize), splitting the range with
+// Matrix::getChunks into tasks on the global thread pool when
+// parallel is true.
+template<typename Body>
+void parallelFor(const size_t loopSize, const size_t granularity,
+                 const bool parallel, const Body& body) {
+    ThreadPool& pool = ThreadPool::global();
+    const size_t threads = parallel ? pool.concurrency() : 1;
+    if (threads == 1) {
+        body(0, loopSize);  // Serial loops do not allocate any chunks.
+        return;
+    }
+    const auto chunks = Matrix::getChunks(loopSize,
+                                          threads * ChunksPerThread,
+                                          granularity);
+    if (chunks.size() <= 1) {
+        body(0, loopSize);
+        return;
+    }
+    TaskGroup group(pool);
+    for (size_t i = 1; (i < chunks.size()); i++) {
+        const auto chunk = chunks[i];
+        group.run([&body, chunk] { body(chunk[0], chunk[1]); });
+    }
+    body(chunks[0][0], chunks[0][1]);  // Use the calling thread too.
+    group.wait();
+}
+
+// Runs body(r0, r1, c0, c1) over the tiles of a rows x cols iteration
+// space on the global thread pool when parallel is true.  Rows are
+// split first; the columns are split only if there are too few bands
+// of rows to keep every thread busy.  Tile edges are multiples of
+// rowGran and colGran (except at the ends).
+template<typename Body>
+void parallelTiles(const size_t rows, const size_t cols,
+                   const size_t rowGran, const size_t colGran,
+                   const bool parallel, const Body& body) {
+    ThreadPool& pool = ThreadPool::global();
+    const size_t tasks = parallel ? pool.concurrency() * ChunksPerThread : 1;
+    if (tasks == 1) {
+        body(0, rows, 0, cols);
+        return;
+    }
+    const auto rowChunks = Matrix::getChunks(rows, tasks, rowGran);
+    const size_t colParts = (tasks + rowChunks.size() - 1) /
+        std::max<size_t>(rowChunks.size(), 1);
+    const auto colChunks = Matrix::getChunks(cols, colParts, colGran);
+    if (rowChunks.size() * colChunks.size() <= 1) {
+        body(0, rows, 0, cols);
+        return;
+    }
+    TaskGroup group(pool);
+    for (const auto& rc : rowChunks) {
+        for (const auto& cc : colChunks) {
+            group.run([&body, rc, cc] { body(rc[0], rc[1], cc[0], cc[1]); });
+        }
+    }
+    group.wait();
+}
+
+// Cache-oblivious transpose of rows [r0, r1) and columns [c0, c1) of
+// the row-major src (row pitch lds) into dst (row pitch ldd).  The
+// larger dimension is halved until the block fits in the L1 cache.
+template<typename T>
+void transposeBlock(const T* src, const size_t lds, T* dst,
+                    const size_t ldd, const size_t r0, const size_t r1,
+                    const size_t c0, const size_t c1) {
+    const size_t rows = r1 - r0, cols = c1 - c0;
+    if ((rows <= TransposeBlock) && (cols <= TransposeBlock)) {
+        for (size_t r = r0; (r < r1); r++) {
+            for (size_t c = c0; (c < c1); c++) {
+                dst[c * ldd + r] = src[r * lds + c];
+            }
+        }
+    } else if (rows >= cols) {
+        const size_t mid = r0 + rows / 2;
+        transposeBlock(src, lds, dst, ldd, r0, mid, c0, c1);
+        transposeBlock(src, lds, dst, ldd, mid, r1, c0, c1);
+    } else {
+        const size_t mid = c0 + cols / 2;
+        transposeBlock(src, lds, dst, ldd, r0, r1, c0, mid);
+        transposeBlock(src, lds, dst, ldd, r0, r1, mid, c1);
+    }
+}
+
+// Computes y = x * B for a 1 x k row vector x and a row-major k x n
+// matrix B (row pitch ldb).  When x is in the accumulation type this
+// is the transposed matrix-vector product, which streams B by rows.
+template<typename T>
+void rowTimes(const T* x, const size_t k, const T* b, const size_t n,
+              const size_t ldb, T* y) {
+    gemm::gemvT(k, n, b, ldb, x, y);
+}
+
+// Overload for a reduced-precision row vector, which the general
+// kernel widens while packing.
+template<typename T, typename TX>
+void rowTimes(const TX* x, const size_t k, const T* b, const size_t n,
+              const size_t ldb, T* y) {
+    gemm::gemm(size_t(1), n, k, x, k, size_t(1), b, ldb, size_t(1), y, n);
+}
+
+// Computes y = x * B' for a 1 x k row vector x and a row-major n x k
+// matrix B (row pitch ldb), i.e., the matrix-vector product B * x'.
+template<typename T>
+void rowTimesT(const T* x, const size_t k, const T* b, const size_t n,
+               const size_t ldb, T* y) {
+    gemm::gemv(n, k, b, ldb, x, y);
+}
+
+// Overload for a reduced-precision row vector (see rowTimes).
+template<typename T, typename TX>
+void rowTimesT(const TX* x, const size_t k, const T* b, const size_t n,
+               const size_t ldb, T* y) {
+    gemm::gemm(size_t(1), n, k, x, k, size_t(1), b, size_t(1), ldb, y, n);
+}
+
+// Returns true if c has any values in the storage of a.  Operands of
+// different types (reduced-precision weights) never share storage.
+template<typename T>
+bool overlaps(const BasicMatrixView<T> c, const BasicMatrixView<const T> a) {
+    return !a.empty() &&
+        c.aliases(a.data(), a.data() + (a.height() - 1) * a.pitch() +
+                  a.width());
+}
+
+template<typename T, typename TA>
+bool overlaps(const BasicMatrixView<T>, const BasicMatrixView<const TA>) {
+    return false;
+}
+
+}  // namespace
+
+namespace matops {
+
+template<typename T, typename TA>
+void multiply(const Product product, const BasicMatrixView<const TA> a,
+              const BasicMatrixView<const T> b, const BasicMatrixView<T> c) {
+    const bool ta = (product == Product::TN), tb = (product == Product::NT);
+    const size_t m = c.height(), n = c.width();
+    const size_t k = ta ? a.height() : a.width();
+    // Ensure the dimensions are similar.
+    assert(m == (ta ? a.width() : a.height()));
+    assert(k == (tb ? b.width() : b.height()));
+    assert(n == (tb ? b.height() : b.width()));
+    assert(!overlaps(c, b) && !overlaps(c, a));
+    const TA* ap = a.data();
+    const T* bp = b.data();
+    T* cp = c.data();
+    const size_t lda = a.pitch(), ldb = b.pitch(), ldc = c.pitch();
+    // Large products are split across the thread pool by bands of
+    // output rows (or columns for short, wide results).
+    const bool parallel = (m * n * k >= ParallelProductThreshold);
+    // Strides of the (possibly transposed) operands for the GEMM.
+    const size_t rsA = ta ? 1 : lda, csA = ta ? lda : 1;
+    const size_t rsB = tb ? 1 : ldb, csB = tb ? ldb : 1;
+    if ((product == Product::NN) && (n == 1) && b.contiguous() &&
+        c.contiguous()) {
+        // Matrix times a column vector (the common case in the neural
+        // net) is a plain matrix-vector product.
+        parallelFor(m, gemm::MR, parallel,
+                    [&](const size_t begin, const size_t end) {
+                        gemm::gemv(end - begin, k, ap + begin * lda, lda,
+                                   bp, cp + begin);
+                    });
+    } else if ((product == Product::NN) && (m == 1)) {
+        // A row vector times a matrix is the transposed matrix-vector
+        // product, which streams the rows of b contiguously.
+        rowTimes(ap, k, bp, n, ldb, cp);
+    } else if ((product == Product::TN) && (n == 1) && b.contiguous() &&
+               c.contiguous()) {
+        // a' * column-vector streams the rows of a.
+        gemm::gemvT(k, m, ap, lda, bp, cp);
+    } else if ((product == Product::NT) && (k == 1) && a.contiguous() &&
+               b.contiguous()) {
+        // Two column vectors: this is an outer product.
+        gemm::ger(m, n, ap, bp, cp, ldc);
+    } else if ((product == Product::NT) && (n == 1) && c.contiguous()) {
+        // b' is a column vector.
+        parallelFor(m, gemm::MR, parallel,
+                    [&](const size_t begin, const size_t end) {
+                        gemm::gemv(end - begin, k, ap + begin * lda, lda,
+                                   bp, cp + begin);
+                    });
+    } else if ((product == Product::NT) && (m == 1)) {
+        // A row vector times b' is b times a column vector.
+        rowTimesT(ap, k, bp, n, ldb, cp);
+    } else {
+        // Do the actual matrix multiplication using the blocked
+        // kernel.  Operands are row-major, so the row stride is the
+        // pitch and the column stride is 1; a transposed operand is
+        // handled by swapping its strides.  Each task computes a tile
+        // of C.  Tiles span at least MC rows and GemmTileCols columns
+        // so that re-packing the operands in every task costs little
+        // relative to the multiply-adds.
+        parallelTiles(m, n, gemm::MC, GemmTileCols, parallel,
+                      [&](const size_t r0, const size_t r1,
+                          const size_t c0, const size_t c1) {
+                          gemm::gemm(r1 - r0, c1 - c0, k, ap + r0 * rsA,
+                                     rsA, csA, bp + c0 * csB, rsB, csB,
+                                     cp + r0 * ldc + c0, ldc);
+                      });
+    }
+}
+
+template<typename T, typename TA>
+void dense(const BasicMatrixView<const TA> a, const BasicMatrixView<const T> x,
+           const BasicMatrixView<const T> bias,
+           const simd::ActivationFn<T> act,
+           const BasicMatrixView<T> out, const BasicMatrixView<T> z) {
+    const size_t m = a.height(), k = a.width();
+    assert((x.height() == k) && (x.width() == 1));
+    assert((bias.height() == m) && (bias.width() == 1));
+    assert((out.height() == m) && (out.width() == 1));
+    assert((z.data() == nullptr) || (z.height() == m));
+    T* zp = z.data();
+    if (x.contiguous() && bias.contiguous() && out.contiguous() &&
+        ((zp == nullptr) || z.contiguous())) {
+        // The usual case of whole column vectors.  Large layers split
+        // their rows across threads like the matrix-vector product.
+        const TA* ap = a.data();
+        const size_t lda = a.pitch();
+        parallelFor(m, gemm::MR, m * k >= ParallelProductThreshold,
+                    [&](const size_t begin, const size_t end) {
+                        gemm::dense(end - begin, k, ap + begin * lda, lda,
+                                    x.data(), bias.data() + begin, act,
+                                    (zp == nullptr) ? zp : zp + begin,
+                                    out.data() + begin);
+                    });
+        return;
+    }
+    // Strided vectors: compute the product and then finish each entry.
+    multiply(Product::NN, a, x, out);
+    for (size_t i = 0; (i < m); i++) {
+        T& val = out.data()[i * out.pitch()];
+        val += bias.data()[i * bias.pitch()];
+        if (zp != nullptr) {
+            zp[i * z.pitch()] = val;
+        }
+        act(&val, &val, 1);
+    }
+}
+
+template<typename T>
+void transpose(const BasicMatrixView<const T> src,
+               const BasicMatrixView<T> dst) {
+    assert((src.height() == dst.width()) && (src.width() == dst.height()));
+    const size_t rows = src.height(), cols = src.width();
+    const size_t lds = src.pitch(), ldd = dst.pitch();
+    const T* sp = src.data();
+    T* dp = dst.data();
+    // Each thread transposes a band of rows of src (i.e., a band of
+    // columns of dst).  The bands are aligned to the block size so
+    // that no block is shared between threads.
+    parallelFor(rows, TransposeBlock, src.count() >= ParallelThreshold,
+                [&](const size_t begin, const size_t end) {
+                    transposeBlock(sp, lds, dp, ldd, begin, end, 0, cols);
+                });
+}
+
+}  // namespace matops
+
+template<typename T>
+BasicMatrix<T>::BasicMatrix(const size_t row, const size_t col,
+                            const T initVal, const size_t pitch)
+        : Storage(row * (pitch == 0 ? col : pitch), initVal) {
     this->col = col;
+    this->rowPitch = (pitch == 0) ? col : pitch;
+    assert(rowPitch >= col);
 }
 
 // Operator to write the matrix to a given output stream
-std::ostream& operator<<(std::ostream& os, const Matrix& matrix) {
+template<typename T>
+std::ostream& operator<<(std::ostream& os, const BasicMatrix<T>& matrix) {
     // Print the number of rows and columns to ease reading
     os << matrix.height() << " " << matrix.width() << '\n';
-    // Print each entry to the output stream.
-    size_t i = 0;
-    // instead of two for loops, only one for loop is needed
-    for (auto& val : matrix) {
-        os << val << " ";
-        i++;
-        if (i == matrix.col) {
-            // Print a new line at the end of each row just to format the
-            // output a bit nicely.
-            os << '\n';
-            i = 0;
+    // Print each entry to the output stream, skipping any padding at
+    // the end of each row.
+    for (size_t row = 0; (row < matrix.height()); row++) {
+        const T* vals = matrix.data() + row * matrix.rowPitch;
+        for (size_t i = 0; (i < matrix.col); i++) {
+            os << vals[i] << " ";
         }
+        // Print a new line at the end of each row just to format the
+        // output a bit nicely.
+        os << '\n';
     }
     return os;
 }
 
 // Operator to read the matrix to a given input stream.
-std::istream& operator>>(std::istream& is, Matrix& matrix) {
+template<typename T>
+std::istream& operator>>(std::istream& is, BasicMatrix<T>& matrix) {
     // Temporary variables to load matrix sizes
     size_t height, width;
     is >> height >> width;
     // Now initialize the destination matrix to ensure it is of the
     // correct dimension.
-    matrix = Matrix(height, width);
+    matrix = BasicMatrix<T>(height, width);
     // Read each entry from the input stream.
     for (auto& val : matrix) {
         is >> val;
@@ -48,92 +337,77 @@ std::istream& operator>>(std::istream& is, Matrix& matrix) {
     return is;
 }
 
-Matrix Matrix::dot(const Matrix& rhs) const {
-    // Ensure the dimensions are similar.
-    assert(col == rhs.height());
-    // Setup the result matrix
-    const auto mWidth = rhs.col;
-    Matrix result(height(), mWidth);
-    size_t r = 0;
-    // Do the actual matrix multiplication
-    for (size_t j = 0; (j < size()); j = j + col) {
-        for (size_t k = 0; (k < rhs.col); k++) {
-            Val sum = 0;
-            for (size_t i = 0; (i < col); i++) {
-                sum += (*this)[i + j] * rhs[i * rhs.col + k];
+template<typename T>
+void BasicMatrix<T>::transposeInPlace() {
+    if (height() != col) {
+        // Non-square matrices change shape, so they need a new buffer.
+        *this = transpose();
+        return;
+    }
+    T* buf = data();
+    const size_t n = col, ld = rowPitch;
+    const size_t blocks = (n + TransposeBlock - 1) / TransposeBlock;
+    // Each band of block-rows swaps its blocks on and above the
+    // diagonal with their mirror images below the diagonal.
+    parallelFor(blocks, 1, size() >= ParallelThreshold,
+                [&](const size_t begin, const size_t end) {
+        for (size_t bi = begin; (bi < end); bi++) {
+            const size_t r0 = bi * TransposeBlock;
+            const size_t r1 = std::min(n, r0 + TransposeBlock);
+            for (size_t c0 = r0; (c0 < n); c0 += TransposeBlock) {
+                const size_t c1 = std::min(n, c0 + TransposeBlock);
+                for (size_t r = r0; (r < r1); r++) {
+                    // On the diagonal block only swap the upper half.
+                    for (size_t c = std::max(c0, r + 1); (c < c1); c++) {
+                        std::swap(buf[r * ld + c], buf[c * ld + r]);
+                    }
+                }
             }
-            // Store the result in an appropriate entry
-            result[r++] = sum;
         }
-    }
-    // Return the computed result
-    return result;
+    });
 }
 
-Matrix Matrix::transpose() const {
-    // If the matrix is empty, then there is nothing much to do.
-    if (empty()) {
-        return *this;
-    }
-
-    // Create a result matrix that will be the transpose, with width
-    // and height flipped.
-    Matrix result(width(), height());
-    // Now copy the values creating the transpose
-    //   START previous code
-/*    size_t i = 0;
-    for (size_t row = 0; (row < width()); row++) {
-        for (size_t colVal = 0; (colVal < result.col); colVal++) {
-            result[i++] = (*this)[row + col * colVal];
-        }
-    }*/
-    // END PREVIOUS CODE
-
-    std::array<size_t, 2> chunkMatrix =
-            getChunkSize(width(), 3);
-
-    size_t i = 0;
-    for (size_t row = 0; (row < chunkMatrix[0]); row++) {
-        for (size_t colVal = 0; (colVal < result.col); colVal++) {
-            result[i++] = (*this)[row + col * colVal];
-        }
-    }
-    for (size_t row = chunkMatrix[0]; (row < chunkMatrix[0] * 2); row++) {
-        for (size_t colVal = 0; (colVal < result.col); colVal++) {
-            result[i++] = (*this)[row + col * colVal];
-        }
-    }
-    for (size_t row = chunkMatrix[0] * 2;
-         (row < chunkMatrix[0] * 2 + chunkMatrix[1]); row++) {
-        for (size_t colVal = 0; (colVal < result.col); colVal++) {
-            result[i++] = (*this)[row + col * colVal];
-        }
-    }
-    // Return the resulting transpose.
-    return result;
-}
-
-/**
- * Perform subtraction between two matrices using pass by reference
- *
- * @param rhs The right hand side matrix
- */
-void Matrix::subtract(const Matrix& rhs) {
-    for (size_t i = 0; i < size(); i++) {
-        (*this)[i] = (*this)[i] - rhs[i];
+template<typename T>
+std::vector<std::array<size_t, 2>>
+BasicMatrix<T>::getChunks(const size_t loopSize, const size_t divisions,
+                  const size_t granularity) {
+    std::vector<std::array<size_t, 2>> chunks;
+    const size_t gran  = std::max<size_t>(granularity, 1);
+    const size_t units = (loopSize + gran - 1) / gran;
+    const size_t parts = std::min(std::max<size_t>(divisions, 1), units);
+    // Distribute the units as evenly as possible with the first few
+    // ranges getting one extra unit if needed.
+    const size_t per = (parts == 0) ? 0 : units / parts;
+    const size_t extra = (parts == 0) ? 0 : units % parts;
+    size_t begin = 0;
+    for (size_t i = 0; (i < parts); i++) {
+        const size_t end = std::min(loopSize,
+                                    begin + (per + (i < extra)) * gran);
+        chunks.push_back({begin, end});
+        begin = end;
     }
+    return chunks;
 }
 
-/**
- * Matrix multiplication by a constant
- * @param c The constant
- */
-Matrix Matrix::mul(const Val c) {
-    for (size_t i = 0; i < size(); i++) {
-        (*this)[i] = (*this)[i] * c;
-    }
-    return *this;
-}
+// Explicit instantiations for the supported element types.
+#define NN_INSTANTIATE_MATRIX(T)                                        \
+    template class BasicMatrix<T>;                                      \
+    template std::ostream& operator<<(std::ostream&, const BasicMatrix<T>&); \
+    template std::istream& operator>>(std::istream&, BasicMatrix<T>&);  \
+    template void matops::multiply<AccumT<T>, T>(                       \
+        matops::Product, BasicMatrixView<const T>,                      \
+        BasicMatrixView<const AccumT<T>>, BasicMatrixView<AccumT<T>>);  \
+    template void matops::dense<AccumT<T>, T>(                          \
+        BasicMatrixView<const T>, BasicMatrixView<const AccumT<T>>,     \
+        BasicMatrixView<const AccumT<T>>, simd::ActivationFn<AccumT<T>>, \
+        BasicMatrixView<AccumT<T>>, BasicMatrixView<AccumT<T>>);        \
+    template void matops::transpose<T>(BasicMatrixView<const T>,        \
+                                       BasicMatrixView<T>);
+
+NN_INSTANTIATE_MATRIX(float)
+NN_INSTANTIATE_MATRIX(double)
+NN_INSTANTIATE_MATRIX(BFloat16)
+NN_INSTANTIATE_MATRIX(Float16)
 
 
 #endif
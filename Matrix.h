@@ -8,10 +8,17 @@
     Copyright (C) 2015 raodm@miamiOH.edu
 */
 
+#include <algorithm>
 #include <iostream>
 #include <functional>
 #include <vector>
+#include <array>
 #include <cassert>
+#include <type_traits>
+#include "AlignedBuffer.h"
+#include "Float16.h"
+#include "MatrixExpr.h"
+#include "MatrixView.h"
 
 /** Shortcut for the value of each element in the matrix */
 using Val = double;
@@ -19,22 +26,57 @@ using Val = double;
 /** Short cut to a 1-d vector double values to streamline the code */
 using SingleRowMatrix = std::vector<Val>;
 
+template<typename T> class BasicMatrix;
+
+/** Stream insertion operator for matrices (see BasicMatrix). */
+template<typename T>
+std::ostream& operator<<(std::ostream& os, const BasicMatrix<T>& matrix);
+
+/** Stream extraction operator for matrices (see BasicMatrix). */
+template<typename T>
+std::istream& operator>>(std::istream& is, BasicMatrix<T>& matrix);
+
 /** A matrix class to perform basic matrix operations.
 
-    The class essentially encapsulates a 2-d matrix of double values
-    and performs the following matrix operations:
+    The class essentially encapsulates a 2-d matrix of values of type
+    T and performs the following matrix operations:
 
     <ul>
     <li>Create a matrix of given dimensions.</li>
 
     <li>Matrix multiplication using Block matrix multiplication.</li>
 
+    <li>Element-wise arithmetic via lazy expression templates (see
+    MatrixExpr.h) that are evaluated without temporaries.</li>
+
     <li> Stream insertion and extraction operators to conveniently
     load and print values.</li>
 
     </ul>
+
+    The element type T may be \c float or \c double, or one of the
+    16-bit storage types from Float16.h (BFloat16 or Float16).
+    Products involving a reduced-precision matrix take a right-hand
+    side in, and produce a result in, the accumulation type
+    AccumT<T> (i.e., float), so that a matrix of weights can be
+    stored compactly while all arithmetic is carried out in float.
+    The Matrix alias (BasicMatrix<Val>) is the default used
+    throughout.
+
+    The values are stored row-major in an AlignedBuffer, so the first
+    row always starts on a cache line.  Consecutive rows are pitch()
+    values apart, which is the width by default.  A larger pitch (see
+    paddedPitch()) pads each row so that every row starts on a cache
+    line too; the padding values are unspecified and never read as
+    part of the matrix.  Iterators and operator[] cover the whole
+    buffer (height() * pitch() values), padding included, so for an
+    unpadded matrix they behave exactly like those of a std::vector.
+
+    \tparam T The type of each element in the matrix.
 */
-class Matrix : public SingleRowMatrix {
+template<typename T>
+class BasicMatrix : public AlignedBuffer<T>,
+                    public MatrixExpr<BasicMatrix<T>> {
     /** Stream insertion operator to ease printing matrices
      *
      * This method prints the dimension of the matrix and then prints
@@ -50,7 +92,9 @@ class Matrix : public SingleRowMatrix {
      * \return As per convention, this method returns the supplied
      * output stream.
      */
-    friend std::ostream& operator<<(std::ostream& os, const Matrix& matrix);
+    template<typename U>
+    friend std::ostream& operator<<(std::ostream& os,
+                                    const BasicMatrix<U>& matrix);
 
     /** Stream extraction operator to ease reading matrices
      *
@@ -67,9 +111,45 @@ class Matrix : public SingleRowMatrix {
      * \return As per convention, this method returns the supplied
      * input stream.
      */
-    friend std::istream& operator>>(std::istream& is, Matrix& matrix);
+    template<typename U>
+    friend std::istream& operator>>(std::istream& is, BasicMatrix<U>& matrix);
+
+    // Matrices of different element types access each other's
+    // internals when computing mixed-precision products.
+    template<typename U> friend class BasicMatrix;
 
 public:
+    /** The contiguous storage for the values in this matrix. */
+    using Storage = AlignedBuffer<T>;
+    using Storage::size;
+    using Storage::data;
+    using Storage::empty;
+    using Storage::begin;
+    using Storage::end;
+    using Storage::resize;
+    using Storage::reserve;
+    using Storage::capacity;
+
+    /** The type used to accumulate products of values of this type. */
+    using Acc = AccumT<T>;
+
+    /** The matrix type for the right-hand side and result of
+        products involving this matrix. */
+    using AccMatrix = BasicMatrix<Acc>;
+
+    /** A mutable view of values of this type (see MatrixView.h). */
+    using View = BasicMatrixView<T>;
+
+    /** A read-only view of values of this type. */
+    using ConstView = BasicMatrixView<const T>;
+
+    /** A read-only view for the right-hand side of products.  A
+        matrix of the accumulation type converts to it implicitly. */
+    using ConstAccView = BasicMatrixView<const Acc>;
+
+    /** A mutable view for the results of products. */
+    using AccView = BasicMatrixView<Acc>;
+
     /**
      * Constructor to create and initialize a matrix.
      *
@@ -80,9 +160,25 @@ public:
      *
      * \param[in] initVal The inital value to be set for each entry in
      * the matrix.
+     *
+     * \param[in] pitch The distance (in values) between the starts of
+     * consecutive rows.  Zero (the default) means \c cols, i.e., no
+     * padding.  Otherwise it must be at least \c cols.
      */
-    explicit Matrix(const size_t rows = 0, const size_t cols = 0,
-                    const Val initVal = 0);
+    explicit BasicMatrix(const size_t rows = 0, const size_t cols = 0,
+                         const T initVal = T(0), const size_t pitch = 0);
+
+    /**
+     * Constructor to create a matrix by converting each value of a
+     * matrix with a different element type, for example to store a
+     * float matrix as BFloat16 or vice versa.
+     *
+     * \param[in] other The matrix whose values are to be converted.
+     */
+    template<typename U>
+    explicit BasicMatrix(const BasicMatrix<U>& other) :
+        Storage(other.begin(), other.end()), col(other.col),
+        rowPitch(other.rowPitch) {}
 
     /**
      * Returns the height or number of rows in this matrix.
@@ -90,7 +186,7 @@ public:
      * \return Returns the height or number of rows in this matrix.
      */
     size_t height() const {
-        return col == 0 ? 0 : (size() / col);
+        return rowPitch == 0 ? 0 : (size() / rowPitch);
     }
 
     /**
@@ -101,161 +197,365 @@ public:
     size_t width() const { return (height() > 0) ? col : 0; }
 
     /**
-     * Creates a new matrix in which each value is obtained by
-     * applying a given unary operator to each entry in the matrix.
+     * Returns the distance (in values) between the starts of
+     * consecutive rows of this matrix.  This is the leading dimension
+     * used by the GEMM kernels.
+     */
+    size_t pitch() const { return rowPitch; }
+
+    /**
+     * Returns the smallest pitch for rows of \c cols values such that
+     * every row starts on a cache line (memory::Alignment bytes).
      *
-     * \param[in] operation The unary operation to be used to create
-     * the given matrix.
+     * \param[in] cols The number of columns in the matrix.
      */
-    template<typename UnaryOp>
-    Matrix apply(const UnaryOp& operation) const {
-        // If the matrix is empty, then we have nothing to do.
-        if (empty()) {
-            return *this;  // return copy of empty matrix.
-        }
-        // Now apply the specified operation to each element and store it
-        // in the new matrix
-        Matrix result = *this;  // Initialize to current values.
-        // Apply unary operation to each element in the result
-        for (auto& val : result) {
-            val = operation(val);
-        }
-        // The resulting matrix after applying specified operations.
-        return result;
+    static size_t paddedPitch(const size_t cols) {
+        const size_t perLine = std::max<size_t>(1,
+                                                memory::Alignment / sizeof(T));
+        return (cols + perLine - 1) / perLine * perLine;
     }
 
-    /**
-     * Creates a new matrix in which each value is obtained by
-     * applying a given binary operator to each entry in this matrix
-     * and another matrix.
-     *
-     * \param[in] other The other matrix to be used. Note that the
-     * other matrix must be exactly the same dimension of this this.
-     * Otherwise, this method throws an exception.
-     *
-     * \param[in] operation The binary operation to be used to create
-     * each value in the given matrix.
-     */
-    template<typename BinaryOp>
-    Matrix apply(const Matrix& other, const BinaryOp& operation) const {
-        // Check to ensure the number of rows are the same.
-        assert(height() == other.height());
-        // If the matrix is empty, then we have nothing to do.
-        if (empty()) {
-            return *this;  // return copy of empty matrix.
-        }
-        // Ensure the number of columns match.
-        assert(col == other.col);
-        // Now apply the specified operation to each element and store it
-        // in the new matrix
-        Matrix result = *this;  // Initialize to current values.
-        // Here we use index so that we can access the corresponding
-        // element in the other matrix as well.
-        for (size_t row = 0; (row < size()); ++row) {
-            // Recollect result is initialized to values of this
-            // matrix. So we use result to reduce the number of
-            // different values accessed.
-            result[row] = operation(result[row], other[row]);
-        }
-        // The resulting matrix after applying specified operations.
-        return result;
+    /** Returns a read-only view of this whole matrix. */
+    ConstView view() const {
+        return ConstView(data(), height(), width(), rowPitch);
+    }
+
+    /** Returns a mutable view of this whole matrix. */
+    View view() { return View(data(), height(), width(), rowPitch); }
+
+    /** Returns a view of a given row (see BasicMatrixView::row). */
+    ConstView row(const size_t r) const { return view().row(r); }
+
+    /** Returns a view of a given row (see BasicMatrixView::row). */
+    View row(const size_t r) { return view().row(r); }
+
+    /** Returns a view of the rows in the range [begin, end). */
+    ConstView rows(const size_t begin, const size_t end) const {
+        return view().rows(begin, end);
+    }
+
+    /** Returns a view of the rows in the range [begin, end). */
+    View rows(const size_t begin, const size_t end) {
+        return view().rows(begin, end);
+    }
+
+    /** Returns a view of a given column. */
+    ConstView column(const size_t c) const { return view().column(c); }
+
+    /** Returns a view of a given column. */
+    View column(const size_t c) { return view().column(c); }
+
+    /** Returns a view of a sub-block (see BasicMatrixView::block). */
+    ConstView block(const size_t row, const size_t col,
+                    const size_t height, const size_t width) const {
+        return view().block(row, col, height, width);
+    }
+
+    /** Returns a view of a sub-block (see BasicMatrixView::block). */
+    View block(const size_t row, const size_t col, const size_t height,
+               const size_t width) {
+        return view().block(row, col, height, width);
     }
 
     /**
-     * Operator to add two matrices with the same dimensions together.
+     * Constructor to create a matrix by evaluating a matrix
+     * expression, such as <tt>a + b * 2.0</tt>, in a single pass.
      *
-     * \param[in] rhs The other matrix to be used.  This matrix must
-     * have the same dimension as this matrix.  Otherwise this method
-     * throws an excpetion.
+     * \param[in] expr The expression to be evaluated.
+     */
+    template<typename E, typename = std::enable_if_t<
+                 std::is_same<typename E::value_type, T>::value>>
+    BasicMatrix(const MatrixExpr<E>& expr) :
+        Storage(expr.count()), col(expr.self().width()), rowPitch(col) {
+        evaluate(expr, data(), rowPitch);
+    }
+
+    /**
+     * Assigns the value of a matrix expression to this matrix.  If
+     * this matrix already has the same dimensions as the expression,
+     * the values are computed directly into this matrix without any
+     * allocation -- even if this matrix is one of the operands, as in
+     * <tt>w = w - nw * eta</tt>.
      *
-     * \return The resulting matrix in which each value has been
-     * computed by adding the corresponding values from \c this and
-     * rhs.
+     * \param[in] expr The expression to be evaluated.
+     */
+    template<typename E, typename = std::enable_if_t<
+                 std::is_same<typename E::value_type, T>::value>>
+    BasicMatrix& operator=(const MatrixExpr<E>& expr) {
+        if ((height() != expr.self().height()) ||
+            (width() != expr.self().width())) {
+            // The dimensions change, so evaluate into a new matrix.
+            return *this = BasicMatrix(expr);
+        }
+        evaluate(expr, data(), rowPitch);
+        return *this;
+    }
+
+    /** Matrices are leaves in a matrix expression. */
+    static constexpr bool isLeaf = true;
+
+    /** An unpadded matrix is one contiguous run of values. */
+    bool contiguous() const { return (rowPitch == col) || (height() <= 1); }
+
+    /**
+     * Returns true if this matrix has any values in the given range.
+     * This method is used by matrix expressions to detect aliasing.
+     */
+    bool aliases(const T* begin, const T* end) const {
+        return !empty() && (data() < end) && (begin < data() + size());
+    }
+
+    /**
+     * Returns true if this matrix does not overlap a destination with
+     * the same dimensions and row pitch \c ld, other than at the same
+     * positions.  This method is used by matrix expressions to detect
+     * operands that must be copied before they are overwritten.
      */
-    Matrix operator+(const Matrix& rhs) const {
-        return apply(rhs, [](const auto& v1, const auto& v2) {
-            return v1 + v2; });
+    bool readsInPlace(const T* dst, const size_t ld) const {
+        return ((data() == dst) && ((height() <= 1) || (rowPitch == ld))) ||
+            !aliases(dst, dst + (height() - 1) * ld + width());
     }
 
     /**
-     * Operator for computing the Hadamard product of two matrices
-     * with the same dimensions.
+     * Returns a pointer to \c n values of this matrix starting at the
+     * given row and column.  This method is used when evaluating
+     * matrix expressions and never needs the scratch buffer.
+     */
+    const T* evalBlock(const size_t row, const size_t column,
+                       const size_t, T*) const {
+        return data() + row * rowPitch + column;
+    }
+
+    /**
+     * Performs the dot product of two matrices. This method has a
+     * O(n^3) time complexity.  The product is computed by the
+     * cache-blocked kernel in Gemm.h and agrees with a naive triple
+     * loop up to floating-point rounding (see Gemm.h for the bound).
+     * Products with a column vector (\c rhs.width() == 1) or by a row
+     * vector (\c height() == 1) take dedicated matrix-vector paths.
      *
-     * \param[in] rhs The other matrix to be used.  This matrix must
-     * have the same dimension as this matrix.  Otherwise this method
-     * throws an excpetion.
+     * \param[in] rhs The other matrix (or view) to be used.  This
+     * matrix must have the same number of rows as the number of
+     * columns in this matrix.  Otherwise this method throws an
+     * excpetion.
      *
      * \return The resulting matrix in which each value has been
      * computed by multiplying the corresponding values from \c this
      * and rhs.
      */
-    Matrix operator*(const Matrix& rhs) const {
-        return apply(rhs, [](const auto& v1, const auto& v2) {
-            return v1 * v2; });
-    }
+    AccMatrix dot(ConstAccView rhs) const { return view().dot(rhs); }
 
     /**
-     * Operator for computing the Hadamard product of two matrices
-     * with the same dimensions.
+     * Performs the dot product of the transpose of this matrix with
+     * another matrix, i.e., \c this' * rhs, without materializing the
+     * transpose.  This is equivalent to \c transpose().dot(rhs).
      *
      * \param[in] rhs The other matrix to be used.  This matrix must
-     * have the same dimension as this matrix.  Otherwise this method
-     * throws an excpetion.
+     * have the same number of rows as this matrix.
      *
-     * \return The resulting matrix in which each value has been
-     * computed by multiplying the corresponding values from \c this
-     * and rhs.
+     * \return The resulting width() x rhs.width() matrix.
      */
-    Matrix operator*(const Val val) const {
-        return apply([val](const auto& v) { return v * val; });
-    }
+    AccMatrix dotTN(ConstAccView rhs) const { return view().dotTN(rhs); }
 
     /**
-     * Operator to subtract two matrices with the same dimensions.
+     * Performs the dot product of this matrix with the transpose of
+     * another matrix, i.e., \c this * rhs', without materializing the
+     * transpose.  This is equivalent to \c dot(rhs.transpose()).
      *
      * \param[in] rhs The other matrix to be used.  This matrix must
-     * have the same dimension as this matrix.  Otherwise this method
-     * throws an excpetion.
+     * have the same number of columns as this matrix.
      *
-     * \return The resulting matrix in which each value has been
-     * computed by subtracting the corresponding values from \c this
-     * and rhs.
+     * \return The resulting height() x rhs.height() matrix.
      */
-    Matrix operator-(const Matrix& rhs) const {
-        return apply(rhs, [](const auto& v1, const auto& v2)  {
-            return v1 - v2; });
-    }
+    AccMatrix dotNT(ConstAccView rhs) const { return view().dotNT(rhs); }
 
     /**
-     * Performs the dot product of two matrices. This method has a
-     * O(n^3) time complexity.
+     * Returns the transpose of this matrix.  The transpose is computed
+     * by recursively splitting the matrix into blocks until they fit
+     * in the L1 cache, so that both the reads and the writes stay
+     * cache friendly.  Large matrices are transposed using multiple
+     * threads, each handling a band of rows of this matrix.
+     */
+    BasicMatrix transpose() const { return view().transpose(); }
+
+    /**
+     * Transposes this matrix in place.  Square matrices are transposed
+     * without any additional memory by swapping blocks across the
+     * diagonal.  Non-square matrices fall back to transpose().
+     */
+    void transposeInPlace();
+
+    /**
+     * Computes the dot product of this matrix and \c rhs into a given
+     * destination matrix.  The destination is resized only if it does
+     * not already have the dimensions of the product, so calling this
+     * method repeatedly with the same destination does not allocate.
      *
-     * \param[in] rhs The other matrix to be used.  This matrix must
-     * have the same number of rows as the number of columns in this
-     * matrix.  Otherwise this method throws an excpetion.
+     * \param[in] rhs The other matrix to be used. See dot().
      *
-     * \return The resulting matrix in which each value has been
-     * computed by multiplying the corresponding values from \c this
-     * and rhs.
+     * \param[out] out The matrix (or a view of the correct
+     * dimensions) to hold the result.  It must not overlap \c this or
+     * \c rhs.
+     */
+    void dotInto(ConstAccView rhs, AccMatrix& out) const {
+        view().dotInto(rhs, out);
+    }
+
+    /** Overload of dotInto() that writes into a view. */
+    void dotInto(ConstAccView rhs, AccView out) const {
+        view().dotInto(rhs, out);
+    }
+
+    /**
+     * Computes \c this' * rhs into a given destination matrix.  See
+     * dotTN() and dotInto().
+     */
+    void dotTNInto(ConstAccView rhs, AccMatrix& out) const {
+        view().dotTNInto(rhs, out);
+    }
+
+    /** Overload of dotTNInto() that writes into a view. */
+    void dotTNInto(ConstAccView rhs, AccView out) const {
+        view().dotTNInto(rhs, out);
+    }
+
+    /**
+     * Computes \c this * rhs' into a given destination matrix.  See
+     * dotNT() and dotInto().
+     */
+    void dotNTInto(ConstAccView rhs, AccMatrix& out) const {
+        view().dotNTInto(rhs, out);
+    }
+
+    /** Overload of dotNTInto() that writes into a view. */
+    void dotNTInto(ConstAccView rhs, AccView out) const {
+        view().dotNTInto(rhs, out);
+    }
+
+    /**
+     * Computes a dense layer, act(this * x + bias), into a given
+     * destination in one sweep over the rows of this matrix.  See
+     * BasicMatrixView::denseInto().
      */
-    Matrix dot(const Matrix& rhs) const;
+    void denseInto(ConstAccView x, ConstAccView bias,
+                   simd::ActivationFn<Acc> act, AccMatrix& out) const {
+        view().denseInto(x, bias, act, out);
+    }
+
+    /** Overload of denseInto() that also keeps the weighted inputs. */
+    void denseInto(ConstAccView x, ConstAccView bias,
+                   simd::ActivationFn<Acc> act, AccMatrix& z,
+                   AccMatrix& out) const {
+        view().denseInto(x, bias, act, z, out);
+    }
 
     /**
-     * Returns the transpose of this matrix.
+     * Changes the dimensions of this matrix.  The underlying storage
+     * is reallocated only if it needs to grow.  The values in the
+     * matrix are unspecified after this call, except that existing
+     * rows are kept when only the number of rows changes.
+     *
+     * \param[in] rows The new number of rows.
+     *
+     * \param[in] cols The new number of columns.
+     *
+     * \param[in] pitch The new row pitch.  Zero (the default) means
+     * \c cols, i.e., no padding.
      */
-    Matrix transpose() const;
+    void reshape(const size_t rows, const size_t cols,
+                 const size_t pitch = 0) {
+        rowPitch = (pitch == 0) ? cols : pitch;
+        assert(rowPitch >= cols);
+        resize(rows * rowPitch);
+        col = cols;
+    }
 
     /**
      * Performs subtract operation between the calling object
-     * and the Matrix passed.
+     * and the Matrix (or view) passed.  This and the other in-place
+     * arithmetic methods below process the values in one pass when
+     * both operands are contiguous, and row by row otherwise.
      */
-    void subtract(const Matrix& rhs);
+    void subtract(ConstView rhs) { view().subtract(rhs); }
+
     /**
      * Performs multiply operation between the calling object
-     * and the Matrix passed.
+     * and the constant passed.
+     *
+     * \return A reference to this matrix.
+     */
+    BasicMatrix& mul(const T rhs) {
+        view().mul(rhs);
+        return *this;
+    }
+
+    /**
+     * Adds the values of another matrix with the same dimensions to
+     * the values of this matrix.
+     *
+     * \param[in] rhs The other matrix to be used.
+     *
+     * \return A reference to this matrix.
+     */
+    BasicMatrix& addInPlace(ConstView rhs) {
+        view().addInPlace(rhs);
+        return *this;
+    }
+
+    /**
+     * Multiplies each value of this matrix by the corresponding value
+     * of another matrix with the same dimensions (i.e., an in-place
+     * Hadamard product).
+     *
+     * \param[in] rhs The other matrix to be used.
+     *
+     * \return A reference to this matrix.
+     */
+    BasicMatrix& hadamardInPlace(ConstView rhs) {
+        view().hadamardInPlace(rhs);
+        return *this;
+    }
+
+    /**
+     * Adds a scaled matrix to this matrix, i.e., this += alpha * x.
+     * For reduced-precision matrices the sum is computed in the
+     * accumulation type and rounded once when it is stored.
+     *
+     * \param[in] alpha The scale factor for the values in \c x.
+     *
+     * \param[in] x The other matrix to be used. It must have the same
+     * dimensions as this matrix.
+     *
+     * \return A reference to this matrix.
+     */
+    BasicMatrix& axpy(const Acc alpha, ConstAccView x) {
+        view().axpy(alpha, x);
+        return *this;
+    }
+
+    /**
+     * Applies a given unary operator to each entry in this matrix,
+     * replacing the entry with the result.  Padding values (if any)
+     * are passed through the operator too.  Large matrices are split
+     * into chunks that are processed in parallel (see mapInPlace()).
+     *
+     * \param[in] operation The unary operation to be used.  It must be
+     * safe to call from several threads at once.
+     *
+     * \return A reference to this matrix.
      */
-    Matrix mul(const Val rhs);
+    template<typename UnaryOp>
+    BasicMatrix& applyInPlace(const UnaryOp& operation) {
+        mapInPlace(data(), 1, size(), size(), operation);
+        return *this;
+    }
 
+    /**
+     * Splits a loop of \c loopSize iterations into \c divisions
+     * ranges.  The first \c divisions - 1 ranges are of the size
+     * returned in the first entry, and the last range is of the size
+     * returned in the second entry.
+     */
     static std::array<size_t, 2>
     getChunkSize(size_t loopSize, size_t divisions) {
         std::array<size_t, 2> arr2{};
@@ -264,23 +564,87 @@ public:
         return arr2;
     }
 
+    /**
+     * Generalized version of getChunkSize that splits a loop of
+     * \c loopSize iterations into at most \c divisions balanced,
+     * contiguous ranges for use by multiple threads.
+     *
+     * \param[in] loopSize The number of iterations to be split.
+     *
+     * \param[in] divisions The maximum number of ranges to create.
+     *
+     * \param[in] granularity Each range (except the last one) starts
+     * and ends on a multiple of this value.  This is used to keep
+     * tiles or cache lines from being split between threads.
+     *
+     * \return The list of [begin, end) ranges.  Fewer than
+     * \c divisions ranges are returned if there is not enough work.
+     */
+    static std::vector<std::array<size_t, 2>>
+    getChunks(size_t loopSize, size_t divisions, size_t granularity = 1);
+
     /**
      *
      * apply a given unary operator on self to each entry in the matrix.
+     * This is the same as applyInPlace(), including its parallelism.
      *
      * \param[in] operation The unary operation to be used to create
      * the given matrix.
      */
     template<typename UnaryOp>
     void selfapply(const UnaryOp& operation) {
-        for (size_t i = 0; i < this->height(); i++) {
-            { (*this)[i] = operation((*this)[i]); }
-        }
+        applyInPlace(operation);
     }
 
 private :
     size_t col = 0;
+
+    /** The distance (in values) between the starts of rows. */
+    size_t rowPitch = 0;
 };
 
+/**
+ * Returns true if two matrices have the same dimensions and values.
+ * Padding (see BasicMatrix::pitch) is not compared.
+ */
+template<typename T>
+bool operator==(const BasicMatrix<T>& lhs, const BasicMatrix<T>& rhs) {
+    if ((lhs.height() != rhs.height()) || (lhs.width() != rhs.width())) {
+        return false;
+    }
+    for (size_t row = 0; (row < lhs.height()); row++) {
+        const T* x = lhs.data() + row * lhs.pitch();
+        if (!std::equal(x, x + lhs.width(), rhs.data() + row * rhs.pitch())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/** Returns true if two matrices differ in dimensions or values. */
+template<typename T>
+bool operator!=(const BasicMatrix<T>& lhs, const BasicMatrix<T>& rhs) {
+    return !(lhs == rhs);
+}
+
+/** The matrix type used throughout, with elements of type Val. */
+using Matrix = BasicMatrix<Val>;
+
+/** A single-precision matrix. */
+using FloatMatrix = BasicMatrix<float>;
+
+/** A mutable view of a Matrix (see MatrixView.h). */
+using MatrixView = BasicMatrixView<Val>;
+
+/** A read-only view of a Matrix (see MatrixView.h). */
+using ConstMatrixView = BasicMatrixView<const Val>;
+
+// The members of BasicMatrix are compiled once, in Matrix.cpp, for
+// each of the supported element types.
+extern template class BasicMatrix<float>;
+extern template class BasicMatrix<double>;
+extern template class BasicMatrix<BFloat16>;
+extern template class BasicMatrix<Float16>;
+
 
 #endif
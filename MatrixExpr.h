@@ -0,0 +1,520 @@
+#ifndef MATRIX_EXPR_H
+#define MATRIX_EXPR_H
+
+/** \file MatrixExpr.h Expression templates for Matrix arithmetic.
+
+    This file contains the lazy expression nodes returned by the
+    Matrix arithmetic operators (+, -, Hadamard *, scalar *) and by
+    Matrix::apply.  Instead of allocating a full matrix per operator,
+    an expression such as <tt>w - (nw * eta)</tt> builds a small tree
+    of nodes that is evaluated in a single pass when it is assigned to
+    (or used to construct) a Matrix.
+
+    Evaluation proceeds in blocks of ExprBlockSize elements.  Each
+    node produces one block of its result into a small stack buffer
+    that stays in the L1 cache, using the runtime-dispatched vector
+    kernels from Simd.h for the built-in operators.  Hence a fused
+    expression allocates no intermediate matrices at all.
+
+    Every value of an expression depends only on the values at the
+    same position in its operands.  So expressions with at least
+    ExprParallelThreshold values are split into chunks of about
+    ExprChunkSize values that are evaluated concurrently on the
+    global thread pool (see ThreadPool.h).  The operators passed to
+    apply() must therefore be safe to call from several threads at
+    once, as pure functions such as a sigmoid are.
+
+    Leaf operands that are lvalues are referenced, while temporaries
+    (for example the result of Matrix::dot) are moved into the
+    expression so that an expression never outlives its operands.
+
+    Copyright (C) 2021 raodm@miamiOH.edu
+*/
+
+#include <cassert>
+#include <cstddef>
+#include <algorithm>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include "Simd.h"
+#include "ThreadPool.h"
+
+/** Number of elements evaluated per block when evaluating an
+    expression.  The per-node scratch buffers must fit in L1. */
+constexpr size_t ExprBlockSize = 256;
+
+/** Number of values at which element-wise operations (expressions
+    and in-place maps) are split across threads.  Below this, the
+    cost of scheduling tasks outweighs the gain. */
+constexpr size_t ExprParallelThreshold = size_t(1) << 15;
+
+/** Number of values processed by each task of a parallel element-wise
+    operation.  It is a multiple of ExprBlockSize and small enough
+    for the operands of a chunk to stay in the L2 cache. */
+constexpr size_t ExprChunkSize = size_t(1) << 13;
+
+/**
+ * The CRTP base class for all matrix expressions (including Matrix
+ * itself).  Every expression type \c E provides:
+ *
+ * <ul>
+ * <li>\c value_type, \c height(), and \c width().</li>
+ *
+ * <li>\c contiguous() -- true if the expression can be evaluated
+ * as one flat run of height() * width() elements.</li>
+ *
+ * <li>\c aliases(begin, end) -- true if the expression reads any
+ * element in the given range.</li>
+ *
+ * <li>\c readsInPlace(dst, ld) -- true if every element the expression
+ * reads from a row-major destination of the same dimensions (with
+ * row pitch \c ld) is at the position that it is written to.</li>
+ *
+ * <li>\c evalBlock(row, col, n, scratch) -- returns a pointer to \c n
+ * consecutive values of the expression starting at (row, col).  The
+ * values are either written to \c scratch or, for leaves, read in
+ * place.  When contiguous() is true, \c row is 0 and \c col indexes
+ * the flattened expression.</li>
+ * </ul>
+ */
+template<typename E>
+class MatrixExpr {
+public:
+    /** Tag used to detect matrix expression types. */
+    using ExprTag = void;
+
+    /** Returns this expression as its concrete type. */
+    const E& self() const { return static_cast<const E&>(*this); }
+
+    /** Returns this expression as its concrete type. */
+    E& self() { return static_cast<E&>(*this); }
+
+    /**
+     * Returns the number of values in this expression.
+     */
+    size_t count() const { return self().height() * self().width(); }
+
+    /**
+     * Creates a lazy expression in which each value is obtained by
+     * applying a given unary operator to each entry in this
+     * expression.
+     *
+     * \param[in] operation The unary operation to be used to create
+     * the values.
+     */
+    template<typename UnaryOp>
+    auto apply(const UnaryOp& operation) const &;
+
+    /** Overload of apply for temporaries, which are moved into the
+        resulting expression. */
+    template<typename UnaryOp>
+    auto apply(const UnaryOp& operation) &&;
+
+    /**
+     * Creates a lazy expression in which each value is obtained by
+     * applying a given binary operator to each entry in this
+     * expression and another expression.
+     *
+     * \param[in] other The other expression to be used. It must have
+     * exactly the same dimensions as this expression.
+     *
+     * \param[in] operation The binary operation to be used to create
+     * each value.
+     */
+    template<typename Other, typename BinaryOp>
+    auto apply(Other&& other, const BinaryOp& operation) const &;
+
+    /** Overload of apply for temporaries, which are moved into the
+        resulting expression. */
+    template<typename Other, typename BinaryOp>
+    auto apply(Other&& other, const BinaryOp& operation) &&;
+
+protected:
+    // Only derived classes are to be created.
+    MatrixExpr() = default;
+};
+
+/** Trait to detect whether a (possibly qualified) type is a matrix
+    expression. */
+template<typename X, typename = void>
+struct IsMatrixExpr : std::false_type {};
+
+/** Specialization for types derived from MatrixExpr. */
+template<typename X>
+struct IsMatrixExpr<X, typename std::decay_t<X>::ExprTag> : std::true_type {};
+
+/**
+ * The type used to hold an operand of type X inside an expression:
+ * lvalue leaves (such as named matrices) are referenced, while
+ * everything else is held by value.
+ */
+template<typename X>
+using ExprOperand = std::conditional_t<std::is_lvalue_reference<X>::value &&
+                                       std::decay_t<X>::isLeaf,
+                                       const std::decay_t<X>&,
+                                       std::decay_t<X>>;
+
+/** The element-wise kernel used by the + operator. */
+struct ExprAdd {
+    template<typename T>
+    void operator()(const T* x, const T* y, T* out, size_t n) const {
+        simd::kernels<T>().add(x, y, out, n);
+    }
+};
+
+/** The element-wise kernel used by the - operator. */
+struct ExprSub {
+    template<typename T>
+    void operator()(const T* x, const T* y, T* out, size_t n) const {
+        simd::kernels<T>().sub(x, y, out, n);
+    }
+};
+
+/** The element-wise kernel used by the Hadamard * operator. */
+struct ExprMul {
+    template<typename T>
+    void operator()(const T* x, const T* y, T* out, size_t n) const {
+        simd::kernels<T>().mul(x, y, out, n);
+    }
+};
+
+/** Adapts a scalar binary operation to the block kernel interface. */
+template<typename BinaryOp>
+struct ExprZip {
+    BinaryOp operation;
+
+    template<typename T>
+    void operator()(const T* x, const T* y, T* out, size_t n) const {
+        for (size_t i = 0; (i < n); i++) {
+            out[i] = operation(x[i], y[i]);
+        }
+    }
+};
+
+/**
+ * An expression that combines two expressions of the same dimensions
+ * element-wise.
+ */
+template<typename L, typename R, typename Op>
+class BinaryExpr : public MatrixExpr<BinaryExpr<L, R, Op>> {
+public:
+    using value_type = typename std::decay_t<L>::value_type;
+    static constexpr bool isLeaf = false;
+
+    template<typename LA, typename RA>
+    BinaryExpr(LA&& lhs, RA&& rhs, const Op& op = Op()) :
+        lhs(std::forward<LA>(lhs)), rhs(std::forward<RA>(rhs)), op(op) {
+        // Ensure the dimensions are the same.
+        assert(this->lhs.height() == this->rhs.height());
+        assert(this->lhs.width() == this->rhs.width());
+    }
+
+    size_t height() const { return lhs.height(); }
+    size_t width()  const { return lhs.width(); }
+    bool contiguous() const { return lhs.contiguous() && rhs.contiguous(); }
+
+    bool aliases(const value_type* begin, const value_type* end) const {
+        return lhs.aliases(begin, end) || rhs.aliases(begin, end);
+    }
+
+    bool readsInPlace(const value_type* dst, const size_t ld) const {
+        return lhs.readsInPlace(dst, ld) && rhs.readsInPlace(dst, ld);
+    }
+
+    const value_type* evalBlock(const size_t row, const size_t col,
+                                const size_t n, value_type* out) const {
+        value_type tmp[ExprBlockSize];
+        const value_type* x = lhs.evalBlock(row, col, n, out);
+        const value_type* y = rhs.evalBlock(row, col, n, tmp);
+        op(x, y, out, n);
+        return out;
+    }
+
+private:
+    L lhs;
+    R rhs;
+    Op op;
+};
+
+/**
+ * An expression that multiplies each value of another expression by
+ * a scalar.
+ */
+template<typename E>
+class ScaleExpr : public MatrixExpr<ScaleExpr<E>> {
+public:
+    using value_type = typename std::decay_t<E>::value_type;
+    static constexpr bool isLeaf = false;
+
+    template<typename EA>
+    ScaleExpr(EA&& expr, const value_type scale) :
+        expr(std::forward<EA>(expr)), scale(scale) {}
+
+    size_t height() const { return expr.height(); }
+    size_t width()  const { return expr.width(); }
+    bool contiguous() const { return expr.contiguous(); }
+
+    bool aliases(const value_type* begin, const value_type* end) const {
+        return expr.aliases(begin, end);
+    }
+
+    bool readsInPlace(const value_type* dst, const size_t ld) const {
+        return expr.readsInPlace(dst, ld);
+    }
+
+    const value_type* evalBlock(const size_t row, const size_t col,
+                                const size_t n, value_type* out) const {
+        const value_type* x = expr.evalBlock(row, col, n, out);
+        simd::kernels<value_type>().scale(x, scale, out, n);
+        return out;
+    }
+
+private:
+    E expr;
+    value_type scale;
+};
+
+/**
+ * An expression that applies a unary operation to each value of
+ * another expression.
+ */
+template<typename E, typename UnaryOp>
+class MapExpr : public MatrixExpr<MapExpr<E, UnaryOp>> {
+public:
+    using value_type = typename std::decay_t<E>::value_type;
+    static constexpr bool isLeaf = false;
+
+    template<typename EA>
+    MapExpr(EA&& expr, const UnaryOp& operation) :
+        expr(std::forward<EA>(expr)), operation(operation) {}
+
+    size_t height() const { return expr.height(); }
+    size_t width()  const { return expr.width(); }
+    bool contiguous() const { return expr.contiguous(); }
+
+    bool aliases(const value_type* begin, const value_type* end) const {
+        return expr.aliases(begin, end);
+    }
+
+    bool readsInPlace(const value_type* dst, const size_t ld) const {
+        return expr.readsInPlace(dst, ld);
+    }
+
+    const value_type* evalBlock(const size_t row, const size_t col,
+                                const size_t n, value_type* out) const {
+        const value_type* x = expr.evalBlock(row, col, n, out);
+        for (size_t i = 0; (i < n); i++) {
+            out[i] = operation(x[i]);
+        }
+        return out;
+    }
+
+private:
+    E expr;
+    UnaryOp operation;
+};
+
+/**
+ * Calls body(row0, row1, col0, col1) for chunks of a rows x cols
+ * element-wise operation, in parallel if the operation is large
+ * enough (see ExprParallelThreshold).  Long single rows are split
+ * into chunks of columns, and everything else into bands of rows.
+ * Column chunks start at multiples of ExprBlockSize, so each value is
+ * computed the same way as in a serial pass.
+ */
+template<typename Body>
+void parallelBlocks(const size_t rows, const size_t cols, const Body& body) {
+    if (rows * cols < ExprParallelThreshold) {
+        body(0, rows, 0, cols);
+    } else if (rows == 1) {
+        parallelChunks(cols, ExprChunkSize, [&](size_t begin, size_t end) {
+                body(0, 1, begin, end); });
+    } else {
+        const size_t bandRows = std::max<size_t>(1, ExprChunkSize / cols);
+        parallelChunks(rows, bandRows, [&](size_t begin, size_t end) {
+                body(begin, end, 0, cols); });
+    }
+}
+
+/**
+ * Evaluates an expression into a row-major destination buffer in a
+ * single blocked pass.  The destination may be one of the leaves of
+ * the expression (for example, <tt>w = w - nw * eta</tt>).  Large
+ * expressions are evaluated in parallel chunks (see parallelBlocks).
+ *
+ * \param[in] expr The expression to be evaluated.
+ *
+ * \param[out] dst The destination for height() x width() values.
+ *
+ * \param[in] ld The distance (in elements) between consecutive rows
+ * of the destination.
+ */
+template<typename E, typename T>
+void evaluate(const MatrixExpr<E>& expr, T* dst, const size_t ld) {
+    const E& e = expr.self();
+    if (e.count() == 0) {
+        return;
+    }
+    // If the destination is also an operand, each block is computed in
+    // a scratch buffer before being stored, so that an operand is
+    // never overwritten before it has been read.  That only holds if
+    // the operand is read at the same positions it is written to.  An
+    // operand at an offset, as in <tt>v.rows(1, n) = v.rows(0, n - 1)
+    // + x</tt>, would read values that other blocks (or other threads)
+    // already overwrote, so such expressions are evaluated into a
+    // temporary that is then copied to the destination.
+    const bool alias = e.aliases(dst, dst + (e.height() - 1) * ld +
+                                 e.width());
+    if (alias && !e.readsInPlace(dst, ld)) {
+        const std::unique_ptr<T[]> tmp(new T[e.count()]);
+        evaluate(expr, tmp.get(), e.width());
+        for (size_t row = 0; (row < e.height()); row++) {
+            std::copy_n(tmp.get() + row * e.width(), e.width(),
+                        dst + row * ld);
+        }
+        return;
+    }
+    // A flat expression writing to a packed destination is evaluated
+    // as a single long row.
+    const bool flat = e.contiguous() && (ld == e.width());
+    const size_t rows = flat ? 1 : e.height();
+    const size_t cols = flat ? e.count() : e.width();
+    parallelBlocks(rows, cols, [&](const size_t row0, const size_t row1,
+                                   const size_t col0, const size_t col1) {
+        T block[ExprBlockSize];
+        for (size_t row = row0; (row < row1); row++) {
+            for (size_t col = col0; (col < col1); col += ExprBlockSize) {
+                const size_t n = std::min(ExprBlockSize, col1 - col);
+                T* out = dst + row * ld + col;
+                const T* res = e.evalBlock(row, col, n, alias ? block : out);
+                if (res != out) {
+                    std::copy_n(res, n, out);
+                }
+            }
+        }
+    });
+}
+
+/**
+ * Replaces each value of a row-major matrix with the result of a
+ * unary operator, in parallel chunks if the matrix is large (see
+ * parallelBlocks).
+ *
+ * \param[in,out] ptr The first value of the matrix.
+ *
+ * \param[in] rows The number of rows.
+ *
+ * \param[in] cols The number of values in each row.
+ *
+ * \param[in] ld The distance (in elements) between consecutive rows.
+ *
+ * \param[in] operation The operator, which must be safe to call from
+ * several threads at once.
+ */
+template<typename T, typename UnaryOp>
+void mapInPlace(T* ptr, const size_t rows, const size_t cols,
+                const size_t ld, const UnaryOp& operation) {
+    // Rows without gaps between them are processed as one long row.
+    const bool flat = (ld == cols);
+    parallelBlocks(flat ? 1 : rows, flat ? rows * cols : cols,
+                   [&](const size_t row0, const size_t row1,
+                       const size_t col0, const size_t col1) {
+        for (size_t row = row0; (row < row1); row++) {
+            T* vals = ptr + row * ld;
+            for (size_t col = col0; (col < col1); col++) {
+                vals[col] = operation(vals[col]);
+            }
+        }
+    });
+}
+
+// ------------------[ MatrixExpr::apply implementations ]----------------
+
+template<typename E>
+template<typename UnaryOp>
+auto MatrixExpr<E>::apply(const UnaryOp& operation) const & {
+    return MapExpr<ExprOperand<const E&>, std::decay_t<UnaryOp>>(self(),
+                                                                operation);
+}
+
+template<typename E>
+template<typename UnaryOp>
+auto MatrixExpr<E>::apply(const UnaryOp& operation) && {
+    return MapExpr<E, std::decay_t<UnaryOp>>(std::move(self()), operation);
+}
+
+template<typename E>
+template<typename Other, typename BinaryOp>
+auto MatrixExpr<E>::apply(Other&& other, const BinaryOp& operation) const & {
+    using Zip = ExprZip<std::decay_t<BinaryOp>>;
+    return BinaryExpr<ExprOperand<const E&>, ExprOperand<Other>, Zip>(
+        self(), std::forward<Other>(other), Zip{operation});
+}
+
+template<typename E>
+template<typename Other, typename BinaryOp>
+auto MatrixExpr<E>::apply(Other&& other, const BinaryOp& operation) && {
+    using Zip = ExprZip<std::decay_t<BinaryOp>>;
+    return BinaryExpr<E, ExprOperand<Other>, Zip>(
+        std::move(self()), std::forward<Other>(other), Zip{operation});
+}
+
+// --------------------------[ Operators ]-------------------------------
+
+/** Enables an operator only if both operands are matrix expressions. */
+template<typename L, typename R>
+using EnableIfExprs = std::enable_if_t<IsMatrixExpr<L>::value &&
+                                       IsMatrixExpr<R>::value>;
+
+/**
+ * Operator to add two matrix expressions with the same dimensions.
+ *
+ * \return A lazy expression in which each value is the sum of the
+ * corresponding values from \c lhs and \c rhs.
+ */
+template<typename L, typename R, typename = EnableIfExprs<L, R>>
+auto operator+(L&& lhs, R&& rhs) {
+    return BinaryExpr<ExprOperand<L>, ExprOperand<R>, ExprAdd>(
+        std::forward<L>(lhs), std::forward<R>(rhs));
+}
+
+/**
+ * Operator to subtract two matrix expressions with the same
+ * dimensions.
+ *
+ * \return A lazy expression in which each value is the difference of
+ * the corresponding values from \c lhs and \c rhs.
+ */
+template<typename L, typename R, typename = EnableIfExprs<L, R>>
+auto operator-(L&& lhs, R&& rhs) {
+    return BinaryExpr<ExprOperand<L>, ExprOperand<R>, ExprSub>(
+        std::forward<L>(lhs), std::forward<R>(rhs));
+}
+
+/**
+ * Operator for computing the Hadamard product of two matrix
+ * expressions with the same dimensions.
+ *
+ * \return A lazy expression in which each value is the product of the
+ * corresponding values from \c lhs and \c rhs.
+ */
+template<typename L, typename R, typename = EnableIfExprs<L, R>>
+auto operator*(L&& lhs, R&& rhs) {
+    return BinaryExpr<ExprOperand<L>, ExprOperand<R>, ExprMul>(
+        std::forward<L>(lhs), std::forward<R>(rhs));
+}
+
+/**
+ * Operator for multiplying each value of a matrix expression by a
+ * scalar.
+ *
+ * \return A lazy expression in which each value is the product of the
+ * corresponding value from \c lhs and \c val.
+ */
+template<typename L, typename = std::enable_if_t<IsMatrixExpr<L>::value>>
+auto operator*(L&& lhs, const typename std::decay_t<L>::value_type val) {
+    return ScaleExpr<ExprOperand<L>>(std::forward<L>(lhs), val);
+}
+
+#endif
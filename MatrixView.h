@@ -0,0 +1,518 @@
+#ifndef MATRIX_VIEW_H
+#define MATRIX_VIEW_H
+
+/** \file MatrixView.h Non-owning views of (parts of) matrices.
+
+    This file contains BasicMatrixView, a lightweight handle to a
+    row-major block of values given by a pointer, a height, a width,
+    and a row pitch (leading dimension).  A view does not own its
+    values, so slicing a row range, a column, or a sub-block out of a
+    Matrix (or out of any other buffer, such as one big dataset
+    matrix) never copies anything.
+
+    Views are accepted wherever the Matrix kernels take an operand:
+    Matrix::dot and friends take a const view of their right-hand
+    side (to which a Matrix converts implicitly), views are leaves in
+    matrix expressions (so <tt>a.row(0) + b.row(1)</tt> and
+    <tt>v.apply(f)</tt> work as with matrices), and the results of
+    products and expressions can be written into a mutable view.
+
+    As with std::string_view, a view must not outlive the values it
+    refers to.  A view of a \c const element type (see
+    ConstMatrixView) is read-only.
+
+    Copyright (C) 2021 raodm@miamiOH.edu
+*/
+
+#include <cassert>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+#include "Float16.h"
+#include "MatrixExpr.h"
+#include "Simd.h"
+
+template<typename T> class BasicMatrix;
+template<typename T> class BasicMatrixView;
+
+/** The kernels behind the products and element-wise operations of
+    matrices and views. */
+namespace matops {
+
+/** The supported products: A * B, A' * B, and A * B'. */
+enum class Product { NN, TN, NT };
+
+/**
+ * Computes the product op(A) * op(B) into C, where op transposes its
+ * operand as given by \c product.  Depending on the shapes, the
+ * product is computed by the matrix-vector or outer-product kernels
+ * or by the blocked GEMM (see Gemm.h).
+ *
+ * \param[in] product Which operands are transposed.
+ *
+ * \param[in] a The left operand, possibly in reduced precision.
+ *
+ * \param[in] b The right operand, in the accumulation type T.
+ *
+ * \param[out] c The result.  It must have the dimensions of the
+ * product and must not overlap either operand.
+ */
+template<typename T, typename TA>
+void multiply(Product product, BasicMatrixView<const TA> a,
+              BasicMatrixView<const T> b, BasicMatrixView<T> c);
+
+/**
+ * Computes a dense layer, z = A * x + bias and out = act(z), in one
+ * sweep over the rows of A (see gemm::dense).  Operands that are not
+ * contiguous column vectors fall back to a product followed by a pass
+ * for the bias and activation.
+ *
+ * \param[in] a The weights, possibly in reduced precision.
+ *
+ * \param[in] x The input column vector.
+ *
+ * \param[in] bias The column vector of biases, one per row of \c a.
+ *
+ * \param[in] act The activation function, e.g., from
+ * simd::activations().
+ *
+ * \param[out] out The activations, a column vector with one entry per
+ * row of \c a.  It must not overlap the other operands.
+ *
+ * \param[out] z The weighted inputs, with the dimensions of \c out,
+ * or an empty view if they are not needed.
+ */
+template<typename T, typename TA>
+void dense(BasicMatrixView<const TA> a, BasicMatrixView<const T> x,
+           BasicMatrixView<const T> bias, simd::ActivationFn<T> act,
+           BasicMatrixView<T> out, BasicMatrixView<T> z);
+
+/**
+ * Writes the transpose of \c src into \c dst, which must have the
+ * transposed dimensions.  Large views are transposed using multiple
+ * threads.
+ */
+template<typename T>
+void transpose(BasicMatrixView<const T> src, BasicMatrixView<T> dst);
+
+/**
+ * Reshapes a destination matrix to rows x cols unless it already has
+ * those dimensions, so that its pitch and buffer are kept.
+ */
+template<typename M>
+void fit(M& out, const size_t rows, const size_t cols) {
+    if ((out.height() != rows) || (out.width() != cols)) {
+        out.reshape(rows, cols);
+    }
+}
+
+/**
+ * Calls body(dst, src, n) for each row of \c dst and the matching row
+ * of \c src, or just once for all the values if both views are
+ * contiguous.
+ */
+template<typename T, typename U, typename Body>
+void zipRows(const BasicMatrixView<T>& dst, const BasicMatrixView<U>& src,
+             const Body& body) {
+    assert((dst.height() == src.height()) && (dst.width() == src.width()));
+    if (dst.contiguous() && src.contiguous()) {
+        body(dst.data(), src.data(), dst.count());
+        return;
+    }
+    for (size_t row = 0; (row < dst.height()); row++) {
+        body(dst.data() + row * dst.pitch(), src.data() + row * src.pitch(),
+             dst.width());
+    }
+}
+
+/** Computes y += alpha * x with the vector kernel. */
+template<typename T>
+void axpy(const T alpha, const T* x, T* y, const size_t n) {
+    simd::kernels<T>().axpy(alpha, x, y, n);
+}
+
+/** Overload for reduced-precision destinations: each sum is computed
+    in the accumulation type and rounded once. */
+template<typename T, typename TY>
+void axpy(const T alpha, const T* x, TY* y, const size_t n) {
+    for (size_t i = 0; (i < n); i++) {
+        y[i] = static_cast<TY>(static_cast<T>(y[i]) + alpha * x[i]);
+    }
+}
+
+}  // namespace matops
+
+/**
+ * A non-owning view of a row-major block of values.
+ *
+ * \tparam T The type of each value.  Use a \c const type for a
+ * read-only view.
+ */
+template<typename T>
+class BasicMatrixView : public MatrixExpr<BasicMatrixView<T>> {
+public:
+    /** The type of the values in this view (without const). */
+    using value_type = std::remove_const_t<T>;
+
+    /** The type used to accumulate products of values of this type. */
+    using Acc = AccumT<value_type>;
+
+    /** The matrix type for the results of products. */
+    using AccMatrix = BasicMatrix<Acc>;
+
+    /** A read-only view of values of this type. */
+    using ConstView = BasicMatrixView<const value_type>;
+
+    /** A read-only view for the right-hand side of products. */
+    using ConstAccView = BasicMatrixView<const Acc>;
+
+    /** A mutable view for the results of products. */
+    using AccView = BasicMatrixView<Acc>;
+
+    /** Creates an empty view. */
+    BasicMatrixView() = default;
+
+    /**
+     * Creates a view of a row-major block of values.
+     *
+     * \param[in] data Pointer to the first value in the block.
+     *
+     * \param[in] rows The number of rows in the block.
+     *
+     * \param[in] cols The number of columns in the block.
+     *
+     * \param[in] pitch The distance (in values) between the starts of
+     * consecutive rows.  Zero (the default) means \c cols.
+     */
+    BasicMatrixView(T* data, const size_t rows, const size_t cols,
+                    const size_t pitch = 0) :
+        ptr(data), nRows(rows), nCols(cols),
+        ld(pitch == 0 ? cols : pitch) {
+        assert((ld >= cols) || (rows <= 1));
+    }
+
+    /**
+     * Creates a view of a whole matrix.  This constructor is implicit
+     * so that a matrix can be passed wherever a view is expected.
+     *
+     * \param[in] matrix The matrix to be viewed.  A mutable view
+     * requires a non-const matrix.
+     */
+    template<typename M, typename = std::enable_if_t<
+                 std::is_same<std::decay_t<M>,
+                              BasicMatrix<value_type>>::value &&
+                 std::is_convertible<decltype(std::declval<M&>().data()),
+                                     T*>::value>>
+    BasicMatrixView(M&& matrix) :
+        ptr(matrix.data()), nRows(matrix.height()), nCols(matrix.width()),
+        ld(matrix.pitch()) {}
+
+    /** Converts a mutable view to a read-only view. */
+    template<typename U, typename = std::enable_if_t<
+                 std::is_convertible<U*, T*>::value>>
+    BasicMatrixView(const BasicMatrixView<U>& other) :
+        ptr(other.data()), nRows(other.height()), nCols(other.width()),
+        ld(other.pitch()) {}
+
+    /** Returns a pointer to the first value in this view. */
+    T* data() const { return ptr; }
+
+    /** Returns the number of rows in this view. */
+    size_t height() const { return nRows; }
+
+    /** Returns the number of columns in this view. */
+    size_t width() const { return nCols; }
+
+    /** Returns the distance (in values) between consecutive rows. */
+    size_t pitch() const { return ld; }
+
+    /** Returns true if this view has no values. */
+    bool empty() const { return (nRows == 0) || (nCols == 0); }
+
+    /** Returns the value at a given row and column. */
+    T& operator()(const size_t row, const size_t col) const {
+        assert((row < nRows) && (col < nCols));
+        return ptr[row * ld + col];
+    }
+
+    /** Returns a 1 x width() view of a given row. */
+    BasicMatrixView row(const size_t r) const {
+        return block(r, 0, 1, nCols);
+    }
+
+    /** Returns a view of the rows in the range [begin, end). */
+    BasicMatrixView rows(const size_t begin, const size_t end) const {
+        return block(begin, 0, end - begin, nCols);
+    }
+
+    /** Returns a height() x 1 view of a given column. */
+    BasicMatrixView column(const size_t c) const {
+        return block(0, c, nRows, 1);
+    }
+
+    /**
+     * Returns a view of a sub-block of this view.
+     *
+     * \param[in] row The first row of the sub-block.
+     *
+     * \param[in] col The first column of the sub-block.
+     *
+     * \param[in] height The number of rows in the sub-block.
+     *
+     * \param[in] width The number of columns in the sub-block.
+     */
+    BasicMatrixView block(const size_t row, const size_t col,
+                          const size_t height, const size_t width) const {
+        assert((row + height <= nRows) && (col + width <= nCols));
+        return BasicMatrixView(ptr + row * ld + col, height, width, ld);
+    }
+
+    /**
+     * Returns the values of this contiguous view as a single column,
+     * e.g., to use a 1 x n row of a dataset as an n x 1 input vector.
+     */
+    BasicMatrixView asColumn() const {
+        assert(contiguous());
+        return BasicMatrixView(ptr, nRows * nCols, 1, 1);
+    }
+
+    /** Views are leaves in a matrix expression. */
+    static constexpr bool isLeaf = true;
+
+    /** A view without gaps between rows is one contiguous run. */
+    bool contiguous() const { return (ld == nCols) || (nRows <= 1); }
+
+    /** Returns true if this view has any values in the given range. */
+    bool aliases(const value_type* begin, const value_type* end) const {
+        return !empty() && (ptr < end) &&
+            (begin < ptr + (nRows - 1) * ld + nCols);
+    }
+
+    /** Returns true if this view does not overlap a destination with
+        the same dimensions and row pitch \c dstLd, other than at the
+        same positions. */
+    bool readsInPlace(const value_type* dst, const size_t dstLd) const {
+        return ((ptr == dst) && ((nRows <= 1) || (ld == dstLd))) ||
+            !aliases(dst, dst + (nRows - 1) * dstLd + nCols);
+    }
+
+    /** Returns a pointer to \c n values starting at (row, col).  This
+        method is used when evaluating matrix expressions. */
+    const value_type* evalBlock(const size_t row, const size_t col,
+                                const size_t, value_type*) const {
+        return ptr + row * ld + col;
+    }
+
+    /**
+     * Performs the dot product of this view and \c rhs.  See
+     * BasicMatrix::dot().
+     */
+    AccMatrix dot(ConstAccView rhs) const {
+        AccMatrix result;
+        dotInto(rhs, result);
+        return result;
+    }
+
+    /** Computes \c this' * rhs.  See BasicMatrix::dotTN(). */
+    AccMatrix dotTN(ConstAccView rhs) const {
+        AccMatrix result;
+        dotTNInto(rhs, result);
+        return result;
+    }
+
+    /** Computes \c this * rhs'.  See BasicMatrix::dotNT(). */
+    AccMatrix dotNT(ConstAccView rhs) const {
+        AccMatrix result;
+        dotNTInto(rhs, result);
+        return result;
+    }
+
+    /**
+     * Computes the dot product of this view and \c rhs into a given
+     * matrix, which is resized only if it does not already have the
+     * dimensions of the product.
+     *
+     * \param[in] rhs The other operand.
+     *
+     * \param[out] out The matrix to hold the result.  It must not
+     * overlap either operand.
+     */
+    void dotInto(ConstAccView rhs, AccMatrix& out) const {
+        matops::fit(out, nRows, rhs.width());
+        dotInto(rhs, out.view());
+    }
+
+    /**
+     * Computes the dot product of this view and \c rhs into a given
+     * view, which must have the dimensions of the product.
+     *
+     * \param[in] rhs The other operand.
+     *
+     * \param[out] out The view to hold the result.  It must not
+     * overlap either operand.
+     */
+    void dotInto(ConstAccView rhs, AccView out) const {
+        matops::multiply(matops::Product::NN, ConstView(*this), rhs, out);
+    }
+
+    /** Computes \c this' * rhs into a matrix.  See dotInto(). */
+    void dotTNInto(ConstAccView rhs, AccMatrix& out) const {
+        matops::fit(out, nCols, rhs.width());
+        dotTNInto(rhs, out.view());
+    }
+
+    /** Computes \c this' * rhs into a view.  See dotInto(). */
+    void dotTNInto(ConstAccView rhs, AccView out) const {
+        matops::multiply(matops::Product::TN, ConstView(*this), rhs, out);
+    }
+
+    /** Computes \c this * rhs' into a matrix.  See dotInto(). */
+    void dotNTInto(ConstAccView rhs, AccMatrix& out) const {
+        matops::fit(out, nRows, rhs.height());
+        dotNTInto(rhs, out.view());
+    }
+
+    /** Computes \c this * rhs' into a view.  See dotInto(). */
+    void dotNTInto(ConstAccView rhs, AccView out) const {
+        matops::multiply(matops::Product::NT, ConstView(*this), rhs, out);
+    }
+
+    /**
+     * Computes a dense layer, act(this * x + bias), into a given
+     * matrix in a single sweep over the rows of this view.  This
+     * gives the same values as computing the product, adding the
+     * bias, and applying the activation separately, without the
+     * intermediate passes and temporaries.
+     *
+     * \param[in] x The input column vector.
+     *
+     * \param[in] bias The column vector of biases.
+     *
+     * \param[in] act The activation function.
+     *
+     * \param[out] out The matrix to hold the activations.  It is
+     * resized only if it is not already a column vector of the right
+     * height.
+     */
+    void denseInto(ConstAccView x, ConstAccView bias,
+                   simd::ActivationFn<Acc> act, AccMatrix& out) const {
+        matops::fit(out, nRows, 1);
+        matops::dense(ConstView(*this), x, bias, act, out.view(), AccView());
+    }
+
+    /**
+     * Overload of denseInto() that also keeps the weighted inputs
+     * z = this * x + bias, e.g., for activations whose derivative
+     * cannot be computed from their output.
+     */
+    void denseInto(ConstAccView x, ConstAccView bias,
+                   simd::ActivationFn<Acc> act, AccMatrix& z,
+                   AccMatrix& out) const {
+        matops::fit(z, nRows, 1);
+        matops::fit(out, nRows, 1);
+        matops::dense(ConstView(*this), x, bias, act, out.view(), z.view());
+    }
+
+    /** Returns the transpose of this view as a new matrix. */
+    BasicMatrix<value_type> transpose() const {
+        BasicMatrix<value_type> result(nCols, nRows);
+        matops::transpose(ConstView(*this), result.view());
+        return result;
+    }
+
+    // ---------[ The methods below require a mutable view ]----------
+
+    /**
+     * Writes the value of a matrix expression into the values of this
+     * view.  The expression must have the same dimensions as this
+     * view.  Unlike copy-assignment (which re-points a view), this
+     * method modifies the viewed values.
+     *
+     * \param[in] expr The expression to be evaluated.
+     *
+     * \return A reference to this view.
+     */
+    template<typename E>
+    const BasicMatrixView& assign(const MatrixExpr<E>& expr) const {
+        assert((nRows == expr.self().height()) &&
+               (nCols == expr.self().width()));
+        evaluate(expr, ptr, ld);
+        return *this;
+    }
+
+    /** Subtracts the values of \c rhs from this view. */
+    const BasicMatrixView& subtract(ConstView rhs) const {
+        const auto sub = simd::kernels<T>().sub;
+        matops::zipRows(*this, rhs, [sub](T* dst, const T* src,
+                                          const size_t n) {
+                                        sub(dst, src, dst, n);
+                                    });
+        return *this;
+    }
+
+    /** Multiplies the values of this view by a constant. */
+    const BasicMatrixView& mul(const value_type c) const {
+        const auto scale = simd::kernels<T>().scale;
+        matops::zipRows(*this, ConstView(*this),
+                        [scale, c](T* dst, const T*, const size_t n) {
+                            scale(dst, c, dst, n);
+                        });
+        return *this;
+    }
+
+    /** Adds the values of \c rhs to this view. */
+    const BasicMatrixView& addInPlace(ConstView rhs) const {
+        const auto add = simd::kernels<T>().add;
+        matops::zipRows(*this, rhs, [add](T* dst, const T* src,
+                                          const size_t n) {
+                                        add(dst, src, dst, n);
+                                    });
+        return *this;
+    }
+
+    /** Multiplies each value of this view by that of \c rhs. */
+    const BasicMatrixView& hadamardInPlace(ConstView rhs) const {
+        const auto mul = simd::kernels<T>().mul;
+        matops::zipRows(*this, rhs, [mul](T* dst, const T* src,
+                                          const size_t n) {
+                                        mul(dst, src, dst, n);
+                                    });
+        return *this;
+    }
+
+    /** Computes this += alpha * x.  See BasicMatrix::axpy(). */
+    const BasicMatrixView& axpy(const Acc alpha, ConstAccView x) const {
+        matops::zipRows(*this, x, [alpha](T* dst, const Acc* src,
+                                          const size_t n) {
+                                      matops::axpy(alpha, src, dst, n);
+                                  });
+        return *this;
+    }
+
+    /**
+     * Applies a given unary operator to each value in this view,
+     * replacing the value with the result.  Large views are processed
+     * in parallel (see mapInPlace()), so the operator must be safe to
+     * call from several threads at once.
+     */
+    template<typename UnaryOp>
+    const BasicMatrixView& applyInPlace(const UnaryOp& operation) const {
+        mapInPlace(ptr, nRows, nCols, ld, operation);
+        return *this;
+    }
+
+private:
+    /** The first value in this view. */
+    T* ptr = nullptr;
+
+    /** The number of rows in this view. */
+    size_t nRows = 0;
+
+    /** The number of columns in this view. */
+    size_t nCols = 0;
+
+    /** The distance (in values) between the starts of rows. */
+    size_t ld = 0;
+};
+
+#endif
@@ -17,112 +17,464 @@
 #include <random>
 #include <cmath>
 #include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <memory>
 
 #include "NeuralNet.h"
+#include "ThreadPool.h"
+#include "Numa.h"
+
+namespace {
+
+// Adds alpha * x to the matrix y (of the same dimensions) one value
+// at a time using relaxed atomic loads and stores.  This is the
+// lock-free update used by Hogwild! training: concurrent updates
+// never tear a value, but an update made by another thread between
+// the load and the store of a value is lost.
+template<typename T, typename W>
+void racyAxpy(const T alpha, BasicMatrixView<const T> x,
+              BasicMatrix<W>& y) {
+    for (size_t r = 0; (r < x.height()); r++) {
+        W* const row = y.data() + r * y.pitch();
+        for (size_t c = 0; (c < x.width()); c++) {
+            W value;
+            __atomic_load(row + c, &value, __ATOMIC_RELAXED);
+            value = W(T(value) + alpha * x(r, c));
+            __atomic_store(row + c, &value, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+// Adds the changes that each copy made to a matrix since it was
+// copied from y to y, i.e., y + sum(copy - y), rounding each value
+// once.  This merges the updates of replicas trained concurrently.
+template<typename T, typename W>
+void mergeChanges(BasicMatrix<W>& y,
+                  const std::vector<const BasicMatrix<W>*>& copies) {
+    for (size_t r = 0; (r < y.height()); r++) {
+        W* const row = y.data() + r * y.pitch();
+        for (size_t c = 0; (c < y.width()); c++) {
+            const T value = row[c];
+            T sum = value;
+            for (const auto copy : copies) {
+                sum += T(copy->data()[r * copy->pitch() + c]) - value;
+            }
+            row[c] = W(sum);
+        }
+    }
+}
+
+}  // namespace
+
+// In the definitions below, H, O, and L are the Hidden, Output, and
+// Loss policies of BasicNeuralNet (see Activation.h).
 
 // The constructor to create a neural network with a given number of
 // layers, with each layer having a given number of neurons.
-NeuralNet::NeuralNet(const std::vector<int>& layers) :
-        layerSizes(1, layers.size()) {
+template<typename T, typename W, typename H, typename O, typename L>
+BasicNeuralNet<T, W, H, O, L>::BasicNeuralNet(const std::vector<int>& layers,
+                                              const simd::Accuracy accuracy,
+                                              const unsigned seed) :
+        layerSizes(1, layers.size()), accuracy(accuracy) {
     // Copy the values into the layer size matrix
     std::copy_n(layers.begin(), layers.size(), layerSizes.begin());
-    // Use helper method to initializes matrices to default values.
-    initBiasAndWeightMatrices(layers, biases, weights);
+    // Use helper method to initializes matrices to random values.
+    initBiasAndWeightMatrices(layers, biases, weights, seed);
+    work = Workspace(*this);
+}
+
+// Creates a workspace with the buffers for single samples.
+template<typename T, typename W, typename H, typename O, typename L>
+BasicNeuralNet<T, W, H, O, L>::Workspace::Workspace(
+    const BasicNeuralNet& net) {
+    resize(net.weights.size());
+    for (size_t lyr = 0; (lyr < net.weights.size()); lyr++) {
+        const size_t rows = net.weights[lyr].height();
+        activations[lyr].reshape(rows, 1);
+        nablaB[lyr].reshape(rows, 1);
+        nablaW[lyr].reshape(rows, net.weights[lyr].width());
+    }
+}
+
+template<typename T, typename W, typename H, typename O, typename L>
+void
+BasicNeuralNet<T, W, H, O, L>::Workspace::resize(const size_t layers) {
+    if (activations.size() != layers) {
+        activations.resize(layers);
+        deltas.resize(layers);
+        nablaB.resize(layers);
+        nablaW.resize(layers);
+    }
 }
 
 // Helper method called from the constructor to initialize the biases
 // and weight matrices for each layer in the neural netowrk.
-void
-NeuralNet::initBiasAndWeightMatrices(const std::vector<int>& layerSizes,
-                                     MatrixVec& biases,
-                                     MatrixVec& weights) const {
-    // Optionally use a random number generator to initialize values below.
-    // std::uniform_real_distribution<Val> rndDist;
-    // std::random_device rndGen;
-    // auto rnd = [&](const auto&){ return rndDist(rndGen); };
-
-    // Create the column matrices for each layer in the nnet.  Each
-    // value is initialized with a random value in the range 0 to 1.0
+template<typename T, typename W, typename H, typename O, typename L>
+void BasicNeuralNet<T, W, H, O, L>::initBiasAndWeightMatrices(
+    const std::vector<int>& layerSizes, VectorList& biases,
+    WeightList& weights, const unsigned seed) const {
+    // The raw outputs of std::mt19937 are fully specified (unlike the
+    // algorithms of the standard distributions), so a seed gives the
+    // same network with every standard library.
+    std::mt19937 rndGen(seed);
+    const auto rnd = [&rndGen](const double range) {
+        return range * (2.0 * rndGen() / 4294967296.0 - 1);
+    };
+
+    // Create the column matrices for each layer in the nnet.  The
+    // biases start out as zeros.  The weights are drawn uniformly from
+    // [-range, range], where the range depends on the activation of
+    // the layer (see Activation.h), so that neurons start out
+    // different from each other.
     for (size_t lyr = 1; (lyr < layerSizes.size()); lyr++) {
         // Convenience variables to keep code readable
         const int rows = layerSizes.at(lyr), cols = layerSizes.at(lyr - 1);
+        const double range = (lyr + 1 == layerSizes.size()) ?
+            O::initRange(cols, rows) : H::initRange(cols, rows);
 
-        // biases.push_back(Matrix(rows, 1).apply(rnd));
-        biases.push_back(Matrix(rows, 1));
+        biases.push_back(Vector(rows, 1));
 
         // Create the 2-D matrices of weights for each layer
-        // weights.push_back(Matrix(rows, cols).apply(rnd));
-        weights.push_back(Matrix(rows, cols));
+        WeightMatrix layer(rows, cols);
+        for (int r = 0; (r < rows); r++) {
+            W* const row = layer.data() + r * layer.pitch();
+            for (int c = 0; (c < cols); c++) {
+                row[c] = W(T(rnd(range)));
+            }
+        }
+        weights.push_back(std::move(layer));
+    }
+}
+
+// Computes the outputs of each layer for one input.
+template<typename T, typename W, typename H, typename O, typename L>
+void
+BasicNeuralNet<T, W, H, O, L>::forward(ConstView inputs, Workspace& ws) const {
+    ws.resize(weights.size());
+    // The inputs are only viewed (not copied) as the inputs to the
+    // first layer, so activations[i] holds the outputs of layer i.
+    for (size_t lyr = 0; (lyr < weights.size()); lyr++) {
+        const ConstView input = (lyr == 0) ? inputs :
+            ConstView(ws.activations[lyr - 1]);
+        weights[lyr].denseInto(input, biases[lyr], layerActivation(lyr),
+                               ws.activations[lyr]);
+    }
+    O::normalize(ws.activations.back().view(), accuracy);
+}
+
+// Computes the outputs of each layer for a batch of inputs.
+template<typename T, typename W, typename H, typename O, typename L>
+void
+BasicNeuralNet<T, W, H, O, L>::forwardBatch(ConstView inputs,
+                                            Workspace& ws) const {
+    // The outputs of each layer hold one sample per column.  The
+    // first layer reads the inputs (one per row) via an NT product,
+    // so nothing is ever transposed.
+    ws.resize(weights.size());
+    for (size_t lyr = 0; (lyr < weights.size()); lyr++) {
+        const simd::ActivationFn<T> act = layerActivation(lyr);
+        Vector& z = ws.activations[lyr];
+        if (lyr == 0) {
+            weights[lyr].dotNTInto(inputs, z);
+        } else {
+            weights[lyr].dotInto(ws.activations[lyr - 1], z);
+        }
+        // Add the bias of each neuron to its row and apply the
+        // activation while the row is in the cache.
+        for (size_t r = 0; (r < z.height()); r++) {
+            const T bias = biases[lyr][r];
+            T* const row = z.data() + r * z.pitch();
+            for (size_t j = 0; (j < z.width()); j++) {
+                row[j] += bias;
+            }
+            act(row, row, z.width());
+        }
+    }
+    O::normalize(ws.activations.back().view(), accuracy);
+}
+
+// Computes the gradients of the biases and weights of each layer for
+// one sample via back propagation.
+template<typename T, typename W, typename H, typename O, typename L>
+void
+BasicNeuralNet<T, W, H, O, L>::backprop(ConstView inputs, ConstView expected,
+                                        Workspace& ws) const {
+    // Do the forward propagation layer-by-layer
+    forward(inputs, ws);
+    const auto layerInput = [&](const size_t lyr) {
+        return (lyr == 0) ? inputs : ConstView(ws.activations[lyr - 1]);
+    };
+
+    // ----------------[ Now do the backward pass ]-----------------
+    // This pass computes nabla (∇) in weights and biases so that the
+    // network can be suitably updated to minimize errors.  The error
+    // (delta) of each layer is the gradient of its biases, so it is
+    // computed directly into nablaB.  The derivatives of the
+    // activations are obtained from the activations themselves.
+    const size_t lastLyr = weights.size() - 1;
+    ws.nablaB[lastLyr] = ws.activations.back().apply(expected,
+        [](const T a, const T y) { return L::template delta<O>(a, y); });
+    ws.nablaB[lastLyr].dotNTInto(layerInput(lastLyr), ws.nablaW[lastLyr]);
+
+    // We propagate the errors backwards (to correct weights and
+    // biases), from the outputs back to the inputs.
+    for (size_t lyr = lastLyr; (lyr-- > 0);) {
+        weights[lyr + 1].dotTNInto(ws.nablaB[lyr + 1], ws.nablaB[lyr]);
+        ws.nablaB[lyr] = ws.nablaB[lyr] * ws.activations[lyr].apply(
+            [](const T a) { return H::derivative(a); });
+        ws.nablaB[lyr].dotNTInto(layerInput(lyr), ws.nablaW[lyr]);
     }
 }
 
 // The main learning method that essentially uses matrix operations
 // for performing the operations to update weights and biases for each
 // layer in the neural network.
-void NeuralNet::learn(const Matrix& inputs, const Matrix& expected,
-                      const Val eta) {
-    // First process the information by feeding inputs through each
-    // layer and recording the intermediate results.
-    auto activation = inputs;
+template<typename T, typename W, typename H, typename O, typename L>
+void
+BasicNeuralNet<T, W, H, O, L>::learn(ConstView inputs, ConstView expected,
+                                     const T eta) {
+    // Compute the gradients for this sample.
+    backprop(inputs, expected, work);
 
-    // List of matrices to store the deltas and errors for each layer
-    MatrixVec activations = { inputs }, zs;
+    // Now finally update the weights and biases for each layer.
+    for (size_t lyr = 0; (lyr < weights.size()); lyr++) {
+        // The weights are updated in place, rounding each updated
+        // value once when they are stored in reduced precision.
+        weights[lyr].axpy(-eta, work.nablaW[lyr]);
+        biases[lyr]  = biases[lyr]  - (work.nablaB[lyr] * eta);
+    }
+}
 
-    // Do the forward propagation layer-by-layer
-    for (size_t lyr = 0; (lyr < biases.size()); lyr++) {
-        zs.push_back(weights[lyr].dot(activation) + biases[lyr]);
-        // Update activations for the next layer (i.e., next iteration)
-        activation = zs.back().apply(sigmoid);
-        // Store activations for each layer for use in backward-pass below.
-        activations.push_back(activation);
+// Computes the sums of the gradients for a batch of samples (one per
+// row) with one matrix product per layer in each pass.
+template<typename T, typename W, typename H, typename O, typename L>
+void
+BasicNeuralNet<T, W, H, O, L>::backpropBatch(ConstView inputs,
+                                             ConstView expected,
+                                             Workspace& ws) const {
+    // The forward pass keeps one sample per column.
+    const size_t layers = weights.size(), count = inputs.height();
+    forwardBatch(inputs, ws);
+
+    // The error of the output layer, with a = activation(r, j):
+    // delta(r, j) = L::delta(a, expected(j, r)).
+    const Vector& out = ws.activations.back();
+    Vector& delta = ws.deltas.back();
+    delta.reshape(out.height(), count);
+    for (size_t r = 0; (r < delta.height()); r++) {
+        T* const row = delta.data() + r * delta.pitch();
+        const T* const act = out.data() + r * out.pitch();
+        for (size_t j = 0; (j < count); j++) {
+            row[j] = L::template delta<O>(act[j], expected(j, r));
+        }
     }
 
-    // ----------------[ Now do the backward pass ]-----------------
-    // This pass computes nabla (∇) in weights and biases so that the
-    // network can be suitably updated to minimize errors.
-    auto delta = (activations.back() - expected) * zs.back().apply(invSigmoid);
+    // Propagate the errors backwards.  The gradient of the biases of a
+    // layer is the sum of its deltas over the samples, and that of its
+    // weights is the product of its deltas with the inputs of the
+    // layer.
+    for (size_t lyr = layers; (lyr-- > 0);) {
+        const Vector& dl = ws.deltas[lyr];
+        ws.nablaB[lyr].reshape(dl.height(), 1);
+        for (size_t r = 0; (r < dl.height()); r++) {
+            const T* const row = dl.data() + r * dl.pitch();
+            T sum = 0;
+            for (size_t j = 0; (j < count); j++) {
+                sum += row[j];
+            }
+            ws.nablaB[lyr].data()[r * ws.nablaB[lyr].pitch()] = sum;
+        }
+        if (lyr == 0) {
+            dl.dotInto(inputs, ws.nablaW[lyr]);
+        } else {
+            dl.dotNTInto(ws.activations[lyr - 1], ws.nablaW[lyr]);
+            weights[lyr].dotTNInto(dl, ws.deltas[lyr - 1]);
+            ws.deltas[lyr - 1] = ws.deltas[lyr - 1] *
+                ws.activations[lyr - 1].apply(
+                    [](const T a) { return H::derivative(a); });
+        }
+    }
+}
+
+// Mini-batch learning with one update from the average gradient of
+// the batch.
+template<typename T, typename W, typename H, typename O, typename L>
+void
+BasicNeuralNet<T, W, H, O, L>::learnBatch(ConstView inputs, ConstView expected,
+                                          const T eta) {
+    assert(inputs.height() == expected.height());
+    if (inputs.height() == 0) {
+        return;
+    }
+    backpropBatch(inputs, expected, work);
+    const T rate = eta / inputs.height();
+    for (size_t lyr = 0; (lyr < weights.size()); lyr++) {
+        weights[lyr].axpy(-rate, work.nablaW[lyr]);
+        biases[lyr].axpy(-rate, work.nablaB[lyr]);
+    }
+}
 
+// Lock-free parallel SGD in the style of Hogwild!.  See the header for
+// the convergence caveat.
+template<typename T, typename W, typename H, typename O, typename L>
+void
+BasicNeuralNet<T, W, H, O, L>::trainHogwild(const BasicDataset<T>& data,
+                                            size_t threads, const T eta) {
+    threads = std::min(threads, ThreadPool::global().concurrency());
+    if (threads <= 1) {
+        // Deterministic fallback: learn the samples in order.
+        for (size_t i = 0; (i < data.size()); i++) {
+            learn(data.input(i), data.expected(i), eta);
+        }
+        return;
+    }
+
+    std::atomic<size_t> next(0);
+    TaskGroup group;
+    if (!numa::enabled()) {
+        const auto worker = [&] { hogwildLoop(data, next, data.size(), eta); };
+        for (size_t t = 1; (t < threads); t++) {
+            group.run(worker);
+        }
+        worker();
+        group.wait();
+        return;
+    }
 
-    // Create intermediate bias and weights matrices to be updated as
-    // part of the back propagation.
-    MatrixVec nabla_b, nabla_w;
-    // Store the delta for use in the interations below
-    nabla_b.push_back(delta);
-    const int lastLyr = layerSizes.size() - 1;
-    nabla_w.push_back(delta.dot(activations.at(lastLyr - 1).transpose()));
+    // NUMA-aware mode: the workers on each node train a replica of
+    // this network on a replica of the data, both placed on the node.
+    // After each round of numa::syncInterval() samples the changes of
+    // all the replicas are merged into this network, which is then
+    // copied back to the replicas.
+    const NodeReplicas<BasicDataset<T>> nodeData(data);
+    NodeReplicas<BasicNeuralNet> nodeNets(*this);
+    const size_t interval = numa::syncInterval();
+    for (size_t round = 0; (round < data.size()); round += interval) {
+        const size_t end = std::min(round + interval, data.size());
+        next = round;
+        const auto worker = [&] {
+            const size_t node = numa::currentNode();
+            nodeNets[node].hogwildLoop(nodeData[node], next, end, eta);
+        };
+        for (size_t t = 1; (t < threads); t++) {
+            group.run(worker);
+        }
+        worker();
+        group.wait();
 
-    // We propagate the errors backwards (to correct weights and
-    // biases), from the outputs back to the inputs. Note that the
-    // order of zs and nabla values are from output to input order.
-    for (auto lyr = 2; (lyr <= lastLyr); lyr++) {
-        const auto sp = zs[lastLyr - lyr].apply(invSigmoid);
-        delta = weights[lastLyr - lyr + 1].transpose().dot(delta) * sp;
-        nabla_b.push_back(delta);
-        nabla_w.push_back(delta.dot(activations[lastLyr - lyr].transpose()));
+        for (size_t lyr = 0; (lyr < weights.size()); lyr++) {
+            std::vector<const WeightMatrix*> nodeWeights;
+            std::vector<const Vector*> nodeBiases;
+            for (size_t node = 0; (node < nodeNets.size()); node++) {
+                nodeWeights.push_back(&nodeNets[node].weights[lyr]);
+                nodeBiases.push_back(&nodeNets[node].biases[lyr]);
+            }
+            mergeChanges<T>(weights[lyr], nodeWeights);
+            mergeChanges<T>(biases[lyr], nodeBiases);
+        }
+        if (end < data.size()) {
+            nodeNets.sync(*this);
+        }
     }
+}
 
-    /* Debugging code
-    if ((nabla_b.back()[0][0] - nabla_b.back().back()[0]) > 0) {
-        std::cout << std::setprecision(17) << "nabla_b: "
-                  << nabla_b.back()[0][0] << " " << nabla_b.back().back()[0]
-                  << " " << nabla_b.back()[5][0]
-                  << '\n';
+// The loop run by each Hogwild! worker on this network.
+template<typename T, typename W, typename H, typename O, typename L>
+void
+BasicNeuralNet<T, W, H, O, L>::hogwildLoop(const BasicDataset<T>& data,
+                                           std::atomic<size_t>& next,
+                                           const size_t end, const T eta) {
+    // Each worker claims samples from a shared counter until none are
+    // left, so faster workers simply process more samples.
+    Workspace ws(*this);
+    for (size_t i = next++; (i < end); i = next++) {
+        backprop(data.input(i), data.expected(i), ws);
+        for (size_t lyr = 0; (lyr < weights.size()); lyr++) {
+            racyAxpy(-eta, ConstView(ws.nablaW[lyr]), weights[lyr]);
+            racyAxpy(-eta, ConstView(ws.nablaB[lyr]), biases[lyr]);
+        }
+    }
+}
+
+// Synchronous data-parallel mini-batch training.  The shards of each
+// batch and the shape of the reduction tree depend only on the batch
+// and the number of threads, which keeps the results reproducible.
+template<typename T, typename W, typename H, typename O, typename L>
+void
+BasicNeuralNet<T, W, H, O, L>::trainParallel(const BasicDataset<T>& data,
+                                             size_t batchSize,
+                                             size_t threads, const T eta) {
+    batchSize = std::max<size_t>(batchSize, 1);
+    threads   = std::max<size_t>(threads, 1);
+    // The workspace of each shard holds the sums of its gradients.
+    if (shardWork.size() < threads) {
+        shardWork.resize(threads);
     }
-    */
+    // The shards of a full batch are computed once; only a smaller
+    // last batch needs its own.
+    const auto fullShards = Vector::getChunks(batchSize, threads);
+    std::vector<std::array<size_t, 2>> lastShards;
+    // In the NUMA-aware mode each shard reads a replica of the data
+    // on its own node.
+    std::unique_ptr<const NodeReplicas<BasicDataset<T>>> nodeData;
+    if (numa::enabled()) {
+        nodeData.reset(new NodeReplicas<BasicDataset<T>>(data));
+    }
+
+    for (size_t batch = 0; (batch < data.size()); batch += batchSize) {
+        const size_t count = std::min(batchSize, data.size() - batch);
+        if (count < batchSize) {
+            lastShards = Vector::getChunks(count, threads);
+        }
+        const auto& shards = (count < batchSize) ? lastShards : fullShards;
+
+        // Each shard sums the gradients of its samples with matrix
+        // products.  The first shard runs on the calling thread.
+        const auto shard = [&](const size_t s) {
+            const BasicDataset<T>& local = nodeData ? nodeData->local() : data;
+            const size_t begin = batch + shards[s][0];
+            const size_t end   = batch + shards[s][1];
+            backpropBatch(local.inputBatch(begin, end),
+                          local.expectedBatch(begin, end), shardWork[s]);
+        };
+        TaskGroup group;
+        for (size_t s = 1; (s < shards.size()); s++) {
+            group.run([&shard, s] { shard(s); });
+        }
+        shard(0);
+        group.wait();
 
-    // Now finally update the weights and biases for each layer. Note
-    // that the previous loop computes nabla_b and nabla_w in reverse
-    // order. So here we use revLyr variabe to ease accounting for the
-    // reverse order in nabla_w and nabla_b
-    for (auto lyr = 0, revLyr = lastLyr - 1; (lyr < lastLyr); lyr++, revLyr--) {
-        weights[lyr] = weights[lyr] - (nabla_w[revLyr] * eta);
-        biases[lyr]  = biases[lyr]  - (nabla_b[revLyr] * eta);
+        // Pairwise tree reduction into the sums of shard 0: at each
+        // level shard s accumulates shard s + stride.
+        for (size_t stride = 1; (stride < shards.size()); stride *= 2) {
+            for (size_t s = 0; (s + stride < shards.size()); s += 2 * stride) {
+                group.run([&, s, stride] {
+                    for (size_t lyr = 0; (lyr < weights.size()); lyr++) {
+                        Workspace& sum = shardWork[s];
+                        const Workspace& other = shardWork[s + stride];
+                        sum.nablaB[lyr].addInPlace(other.nablaB[lyr]);
+                        sum.nablaW[lyr].addInPlace(other.nablaW[lyr]);
+                    }
+                });
+            }
+            group.wait();
+        }
+
+        // Apply the average gradient of the batch once.
+        const T rate = eta / count;
+        for (size_t lyr = 0; (lyr < weights.size()); lyr++) {
+            weights[lyr].axpy(-rate, shardWork[0].nablaW[lyr]);
+            biases[lyr].axpy(-rate, shardWork[0].nablaB[lyr]);
+        }
     }
 }
 
 // The stream insertion operator to save/write the neural network data
 // to a given file or output stream.
-std::ostream& operator<<(std::ostream& os, const NeuralNet& nnet) {
+template<typename T, typename W, typename H, typename O, typename L>
+std::ostream& operator<<(std::ostream& os,
+                         const BasicNeuralNet<T, W, H, O, L>& nnet) {
     // First print the layer sizes
     os << nnet.layerSizes << '\n';
     // Next print the biases for each layer.
@@ -139,34 +491,109 @@ std::ostream& operator<<(std::ostream& os, const NeuralNet& nnet) {
 
 // The stream extraction operator to load neural network data from a
 // given file or input stream.
-std::istream& operator>>(std::istream& is, NeuralNet& nnet) {
+template<typename T, typename W, typename H, typename O, typename L>
+std::istream& operator>>(std::istream& is,
+                         BasicNeuralNet<T, W, H, O, L>& nnet) {
     // First load the layer sizes
     is >> nnet.layerSizes;
     const int layerCount = nnet.layerSizes.height();
     // Now read the biases for each layer
-    Matrix temp;
+    BasicMatrix<T> temp;
     for (int i = 0; (i < layerCount); i++) {
         is >> temp;
         nnet.biases.push_back(temp);
     }
     // Now read the weights for each layer
+    BasicMatrix<W> weight;
     for (int i = 0; (i < layerCount); i++) {
-        is >> temp;
-        nnet.weights.push_back(temp);
+        is >> weight;
+        nnet.weights.push_back(weight);
     }
     // Return the input stream as per convention
     return is;
 }
 
 
+// Replaces the biases and weights, checking that the dimensions of
+// the network stay the same.
+template<typename T, typename W, typename H, typename O, typename L>
+void
+BasicNeuralNet<T, W, H, O, L>::setParameters(const VectorList& newBiases,
+                                             const WeightList& newWeights) {
+    assert(newBiases.size() == biases.size());
+    assert(newWeights.size() == weights.size());
+    for (size_t lyr = 0; (lyr < weights.size()); lyr++) {
+        assert(newBiases[lyr].height() == biases[lyr].height());
+        assert(newWeights[lyr].height() == weights[lyr].height());
+        assert(newWeights[lyr].width() == weights[lyr].width());
+        biases[lyr]  = newBiases[lyr];
+        weights[lyr] = newWeights[lyr];
+    }
+}
+
+// The method to compute the outputs of one layer.
+template<typename T, typename W, typename H, typename O, typename L>
+typename BasicNeuralNet<T, W, H, O, L>::Vector
+BasicNeuralNet<T, W, H, O, L>::feedForward(const size_t lyr,
+                                           ConstView input) const {
+    Vector result;
+    weights[lyr].denseInto(input, biases[lyr], layerActivation(lyr), result);
+    if (lyr + 1 == weights.size()) {
+        O::normalize(result.view(), accuracy);
+    }
+    return result;
+}
+
 // The method to classify/recognize a given input.
-Matrix
-NeuralNet::classify(const Matrix& inputs) const {
-    Matrix result = inputs;
+template<typename T, typename W, typename H, typename O, typename L>
+typename BasicNeuralNet<T, W, H, O, L>::Vector
+BasicNeuralNet<T, W, H, O, L>::classify(ConstView inputs) const {
+    // The inputs are fed to the first layer without being copied.
+    Vector result;
     for (size_t lyr = 0; (lyr < weights.size()); lyr++) {
-        result = (weights[lyr].dot(result) + biases[lyr]).apply(sigmoid);
+        const ConstView input = (lyr == 0) ? inputs : ConstView(result);
+        result = feedForward(lyr, input);
     }
     return result;
 }
 
+// The method to classify a given input in a workspace.
+template<typename T, typename W, typename H, typename O, typename L>
+const typename BasicNeuralNet<T, W, H, O, L>::Vector&
+BasicNeuralNet<T, W, H, O, L>::classify(ConstView inputs,
+                                        Workspace& ws) const {
+    forward(inputs, ws);
+    return ws.activations.back();
+}
+
+// The method to classify a batch of inputs, one per row.
+template<typename T, typename W, typename H, typename O, typename L>
+typename BasicNeuralNet<T, W, H, O, L>::Vector
+BasicNeuralNet<T, W, H, O, L>::classifyBatch(ConstView inputs) const {
+    Workspace ws;
+    return classifyBatch(inputs, ws);
+}
+
+// The method to classify a batch of inputs, one per row, in a
+// workspace.
+template<typename T, typename W, typename H, typename O, typename L>
+const typename BasicNeuralNet<T, W, H, O, L>::Vector&
+BasicNeuralNet<T, W, H, O, L>::classifyBatch(ConstView inputs,
+                                             Workspace& ws) const {
+    forwardBatch(inputs, ws);
+    return ws.activations.back();
+}
+
+// Explicit instantiations for the supported combinations of compute
+// type (T), weight storage type (W), and policies (see
+// NN_FOR_EACH_NEURAL_NET in NeuralNet.h).
+#define NN_INSTANTIATE_NEURAL_NET(T, W, H, O, L)                        \
+    template class BasicNeuralNet<T, W, H, O, L>;                          \
+    template std::ostream& operator<<(std::ostream&,                    \
+                                      const BasicNeuralNet<T, W, H, O, L>&); \
+    template std::istream& operator>>(std::istream&,                    \
+                                      BasicNeuralNet<T, W, H, O, L>&);
+
+NN_FOR_EACH_NEURAL_NET(NN_INSTANTIATE_NEURAL_NET)
+
 #endif
@@ -10,12 +10,18 @@
  */
 
 #include <iostream>
+#include <atomic>
 #include <functional>
 #include <vector>
 #include <tuple>
 #include <string>
 #include <cstdlib>
+#include <cmath>
+#include <type_traits>
+#include "Activation.h"
 #include "Matrix.h"
+#include "Dataset.h"
+#include "Simd.h"
 
 // A vector containing a list of doubles
 using DoubleVec = std::vector<double>;
@@ -24,12 +30,112 @@ using DoubleVec = std::vector<double>;
 // associated with each layer of the neural net.
 using MatrixVec = std::vector<Matrix>;
 
+template<typename T, typename W, typename H, typename O, typename L>
+class BasicNeuralNet;
+
+/**
+ * Calls INSTANTIATE(T, W, Hidden, Output, Loss) for each network
+ * instantiated in NeuralNet.cpp: every hidden activation and every
+ * supported pair of output activation and loss in Activation.h with
+ * \c float and \c double weights, and the default policies with
+ * reduced-precision weights.  Other networks are rejected at compile
+ * time (see IsNeuralNetInstantiated), so a network must be added here
+ * to be used.
+ */
+#define NN_FOR_EACH_NEURAL_NET(INSTANTIATE)                             \
+    NN_FOR_EACH_POLICY(INSTANTIATE, double)                             \
+    NN_FOR_EACH_POLICY(INSTANTIATE, float)                              \
+    INSTANTIATE(float, BFloat16, activation::Sigmoid,                   \
+                activation::Sigmoid, loss::Quadratic)                   \
+    INSTANTIATE(float, Float16, activation::Sigmoid,                    \
+                activation::Sigmoid, loss::Quadratic)
+
+/** Helper for NN_FOR_EACH_NEURAL_NET for one compute type T. */
+#define NN_FOR_EACH_POLICY(INSTANTIATE, T)                              \
+    NN_FOR_EACH_OUTPUT(INSTANTIATE, T, activation::Sigmoid)             \
+    NN_FOR_EACH_OUTPUT(INSTANTIATE, T, activation::Tanh)                \
+    NN_FOR_EACH_OUTPUT(INSTANTIATE, T, activation::ReLU)                \
+    NN_FOR_EACH_OUTPUT(INSTANTIATE, T, activation::LeakyReLU<>)
+
+/** Helper for NN_FOR_EACH_POLICY for one hidden activation H. */
+#define NN_FOR_EACH_OUTPUT(INSTANTIATE, T, H)                           \
+    INSTANTIATE(T, T, H, activation::Sigmoid, loss::Quadratic)          \
+    INSTANTIATE(T, T, H, activation::Sigmoid, loss::CrossEntropy)       \
+    INSTANTIATE(T, T, H, activation::Softmax, loss::CrossEntropy)
+
+/** Trait that is true for the networks listed by
+    NN_FOR_EACH_NEURAL_NET, whose members are defined in
+    NeuralNet.cpp. */
+template<typename T, typename W, typename H, typename O, typename L>
+struct IsNeuralNetInstantiated : std::false_type {};
+
+#define NN_MARK_INSTANTIATED(T, W, H, O, L)                             \
+    template<>                                                          \
+    struct IsNeuralNetInstantiated<T, W, H, O, L> : std::true_type {};
+
+NN_FOR_EACH_NEURAL_NET(NN_MARK_INSTANTIATED)
+
+#undef NN_MARK_INSTANTIATED
+
+/** Stream insertion operator for neural networks (see BasicNeuralNet). */
+template<typename T, typename W, typename H, typename O, typename L>
+std::ostream& operator<<(std::ostream& os,
+                         const BasicNeuralNet<T, W, H, O, L>& nnet);
+
+/** Stream extraction operator for neural networks (see BasicNeuralNet). */
+template<typename T, typename W, typename H, typename O, typename L>
+std::istream& operator>>(std::istream& is,
+                         BasicNeuralNet<T, W, H, O, L>& nnet);
+
 /**
  * The main NeuralNetwork class. This class is sufficiently flexible
  * to enable creating different neural networks with different number
  * of layers and sizes.
+ *
+ * The network computes in type T (\c float or \c double) and stores
+ * its weights in type W, which defaults to T.  Storing the weights as
+ * BFloat16 or Float16 (with T = float) halves their memory footprint
+ * and bandwidth, which mainly benefits inference: updates smaller than
+ * the precision of W are lost during training.  The NeuralNet alias
+ * (BasicNeuralNet<Val>) is the default used throughout.
+ *
+ * The activation functions and the loss are policies (see
+ * Activation.h) that are resolved at compile time.  For example,
+ *
+ * \code
+ * BasicNeuralNet<float, float, activation::ReLU, activation::Softmax,
+ *                loss::CrossEntropy> net({784, 100, 10});
+ * \endcode
+ *
+ * creates a network with ReLU hidden layers and a softmax output
+ * layer trained with the cross-entropy loss.  Only the networks
+ * listed by NN_FOR_EACH_NEURAL_NET are available.
+ *
+ * \tparam T The type in which activations, biases, and all arithmetic
+ * are computed.
+ *
+ * \tparam W The storage type of the weights.  AccumT<W> must be T.
+ *
+ * \tparam Hidden The activation of the hidden layers.
+ *
+ * \tparam Output The activation of the output layer.
+ *
+ * \tparam Loss The loss function minimized by training.
  */
-class NeuralNet {
+template<typename T, typename W = T, typename Hidden = activation::Sigmoid,
+         typename Output = activation::Sigmoid, typename Loss = loss::Quadratic>
+class BasicNeuralNet {
+    static_assert(std::is_same<AccumT<W>, T>::value,
+                  "Weights must accumulate in the compute type");
+    static_assert(!std::is_same<Hidden, activation::Softmax>::value,
+                  "Softmax is only supported for the output layer");
+    static_assert(Loss::template accepts<Output>,
+                  "The loss does not support the output activation");
+    static_assert(IsNeuralNetInstantiated<T, W, Hidden, Output,
+                                          Loss>::value,
+                  "This network is not instantiated in NeuralNet.cpp; "
+                  "add it to NN_FOR_EACH_NEURAL_NET");
+
     /**
      * A stream insertion operator to save/write the neural network so
      * that the trained network can be saved and loaded easily.
@@ -40,7 +146,9 @@ class NeuralNet {
      * \param[in] nnet The neural network to be serialized to the
      * given output stream.
      */
-    friend std::ostream& operator<<(std::ostream& os, const NeuralNet& nnet);
+    template<typename U, typename V, typename H, typename O, typename L>
+    friend std::ostream& operator<<(std::ostream& os,
+                                    const BasicNeuralNet<U, V, H, O, L>& nnet);
 
     /**
      * The stream extraction operator to read data for a neural
@@ -53,9 +161,84 @@ class NeuralNet {
      * \param[out] nnet The neural network whose data is to be
      * read/modified by this method.
      */
-    friend std::istream& operator>>(std::istream& is, NeuralNet& nnet);
+    template<typename U, typename V, typename H, typename O, typename L>
+    friend std::istream& operator>>(std::istream& is,
+                                    BasicNeuralNet<U, V, H, O, L>& nnet);
 
 public:
+    /** The matrix type for inputs, outputs, and biases. */
+    using Vector = BasicMatrix<T>;
+
+    /** A read-only view of an input or output (see MatrixView.h),
+        to which a Vector converts implicitly. */
+    using ConstView = BasicMatrixView<const T>;
+
+    /** The matrix type for the weights of each layer. */
+    using WeightMatrix = BasicMatrix<W>;
+
+    /** A list of inputs, outputs, or biases. */
+    using VectorList = std::vector<Vector>;
+
+    /** A list of weights for each layer. */
+    using WeightList = std::vector<WeightMatrix>;
+
+    /**
+     * The scratch space used to train a network or to classify with
+     * it: the intermediate results and gradients of each layer.  Each
+     * buffer is resized only when it is too small, so once a
+     * workspace has been used with a given batch size, reusing it for
+     * batches of that size (or smaller) allocates no memory.  Each
+     * network keeps one workspace for learn() and learnBatch(); a
+     * workspace can also be passed to the classification methods,
+     * which are const and may be called by several threads, each with
+     * its own workspace.  See memory::allocationCount() to check that
+     * a loop does not allocate.
+     */
+    class Workspace {
+        friend class BasicNeuralNet;
+
+    public:
+        /** Creates an empty workspace, sized on first use. */
+        Workspace() = default;
+
+        /**
+         * Creates a workspace sized for single samples of a network,
+         * i.e., for learn() and classify().
+         *
+         * \param[in] net The network that will use this workspace.
+         */
+        explicit Workspace(const BasicNeuralNet& net);
+
+        /** Copies are empty: a workspace only holds scratch values, so
+            copying a network (e.g., into a snapshot) does not copy
+            them. */
+        Workspace(const Workspace&) {}
+
+        /** Copy assignment keeps this workspace as it is. */
+        Workspace& operator=(const Workspace&) { return *this; }
+
+        Workspace(Workspace&&) = default;
+        Workspace& operator=(Workspace&&) = default;
+
+    private:
+        /** Ensures that there are buffers for the given number of
+            layers. */
+        void resize(size_t layers);
+
+        /** The outputs (after the activation) of each layer. */
+        VectorList activations;
+
+        /** The errors of each layer for batches of samples. */
+        VectorList deltas;
+
+        /** The gradients of the biases of each layer, which are also
+            the errors of each layer for single samples. */
+        VectorList nablaB;
+
+        /** The gradients of the weights of each layer. */
+        VectorList nablaW;
+    };
+
     /**
      * Creates a neural network with a given number of layers with a
      * given number of neurons at each layer. For example NeuralNet
@@ -65,8 +248,22 @@ public:
      *
      * \param[in] layers The layers and number of neurons on each
      * layer.x
+     *
+     * \param[in] accuracy The accuracy tier of the transcendental
+     * activation functions (sigmoid, tanh, and softmax) used by this
+     * network (see Simd.h).  The approximate tiers compute the
+     * activations of a layer several times faster than the libm-based
+     * default, at the cost of the last few digits.
+     *
+     * \param[in] seed The seed for the initial weights, which are
+     * pseudo-random values scaled for the activation of each layer
+     * (see initRange() in Activation.h).  Networks with the same
+     * layers and seed start out identical.  The biases start out as
+     * zeros.
      */
-    NeuralNet(const std::vector<int>& layers);
+    BasicNeuralNet(const std::vector<int>& layers,
+                   simd::Accuracy accuracy = simd::Accuracy::Exact,
+                   unsigned seed = 1);
 
     /**
      * The helper method that updates the weights and biases of the
@@ -75,31 +272,211 @@ public:
      * \param[in] inputs The input pixels that contain the image to be
      * recognized by the neural network.  The number of pixels in this
      * image must be exactly the same as the number of input neurons
-     * for this neural network.
+     * for this neural network.  This may be a Vector or a view, e.g.,
+     * a row of a dataset matrix viewed as a column, and is never
+     * copied.
      *
-     * \param[in] expected The expected output matrix for this image.
-     * This matrix should be the same dimension as the output layer of
-     * this neural network.
+     * \param[in] expected The expected output matrix (or view) for
+     * this image.  This matrix should be the same dimension as the
+     * output layer of this neural network.
      *
      * \param[in] eta The learning rate at which this neural network
      * is to learn from this one example.
      */
-    void learn(const Matrix& inputs, const Matrix& expected,
-               const Val eta = 0.3);
+    void learn(ConstView inputs, ConstView expected, const T eta = 0.3);
+
+    /**
+     * Updates the weights and biases of the network once with the
+     * average gradient of a mini-batch of samples.  The forward and
+     * backward passes of each layer are computed for all the samples
+     * at once with matrix-matrix products (GEMMs), so each weight is
+     * loaded once per batch rather than once per sample, which is
+     * much faster than calling learn() for each sample.  With one
+     * sample this is the same update as learn(), up to rounding.
+     *
+     * \param[in] inputs The inputs of the samples, one per row, e.g.,
+     * a range of samples of a dataset (see BasicDataset::inputBatch).
+     *
+     * \param[in] expected The expected outputs of the samples, one per
+     * row, in the same order as the inputs.
+     *
+     * \param[in] eta The learning rate.  The update is \c eta times
+     * the average gradient of the samples.
+     */
+    void learnBatch(ConstView inputs, ConstView expected,
+                    const T eta = 0.3);
+
+    /**
+     * Trains this network with one pass of stochastic gradient
+     * descent over a dataset, using several threads in the style of
+     * Hogwild! (Niu et al., 2011).  Each thread repeatedly takes the
+     * next unprocessed sample, computes its gradients from the
+     * current weights, and applies them to the shared weights and
+     * biases without any locking.  Each value is updated with relaxed
+     * atomic loads and stores, so values are never torn, but an
+     * update made by another thread between the load and the store
+     * of a value is lost, and gradients may be computed from weights
+     * that other threads are in the middle of updating.
+     *
+     * \note Hogwild! converges well when updates rarely touch the
+     * same values.  The layers of this network are dense, so every
+     * sample updates every weight and conflicts are frequent: with
+     * many threads or a large \c eta, some updates are lost or
+     * applied to stale weights, and training may need a smaller \c
+     * eta or more epochs to reach the accuracy of sequential
+     * training.  The results also vary from run to run.  Use
+     * trainHogwild(data, 1) (or learn()) for reproducible results.
+     *
+     * In the NUMA-aware mode (see Numa.h) the threads of each NUMA
+     * node instead update a replica of this network placed on that
+     * node, reading a replica of the data on the node.  After every
+     * numa::syncInterval() samples the changes of all the replicas are
+     * added to this network, which is then copied back to them.
+     *
+     * \param[in] data The samples to learn from.  Its input and
+     * output sizes must match the first and last layers.
+     *
+     * \param[in] threads The number of threads to use, at most the
+     * concurrency of ThreadPool::global().  With 1 (or on a machine
+     * with one core) the samples are learned in order on the calling
+     * thread, exactly as a loop calling learn() would.
+     *
+     * \param[in] eta The learning rate.
+     */
+    void trainHogwild(const BasicDataset<T>& data, size_t threads,
+                      const T eta = 0.3);
+
+    /**
+     * Trains this network with one pass of mini-batch gradient
+     * descent over a dataset, computing the gradients of each batch
+     * in parallel.  The samples of a batch are split into \c threads
+     * contiguous shards.  The gradients of each shard are summed by
+     * one task with matrix products (as in learnBatch()), the sums of
+     * the shards are combined by a pairwise tree reduction whose
+     * shape depends only on the number of shards, and the weights and
+     * biases are then updated once with the average gradient of the
+     * batch scaled by \c eta.
+     *
+     * Since the order of every floating-point operation depends only
+     * on the data, \c batchSize, and \c threads (and not on how the
+     * tasks are scheduled), the trained network is bit-identical for
+     * a fixed number of threads, even if ThreadPool::global() has a
+     * different concurrency.  Different thread counts sum in
+     * different orders, so their results differ by rounding.  In the
+     * NUMA-aware mode (see Numa.h) each shard reads a replica of the
+     * data on its own node, which does not change the results.
+     *
+     * \param[in] data The samples to learn from, in the order they are
+     * to be used.  Shuffle the samples between epochs if desired.
+     *
+     * \param[in] batchSize The number of samples in each mini-batch.
+     * The last batch may be smaller.  A batch size of 1 gives plain
+     * stochastic gradient descent, like learn().
+     *
+     * \param[in] threads The number of shards (and tasks) into which
+     * each batch is split.
+     *
+     * \param[in] eta The learning rate.
+     */
+    void trainParallel(const BasicDataset<T>& data, size_t batchSize,
+                       size_t threads, const T eta = 0.3);
 
     /**
      * This method is used to classify or recognize a given image
      * based on the current learning by this neural network.
      *
-     * \param[in] inputs The input image to be classified/recognized
-     * by this neural network.  The number of pixels in this image
-     * must be exactly the same as the number of input neurons for
-     * this neural network.
+     * \param[in] inputs The input image (a Vector or a view) to be
+     * classified/recognized by this neural network.  The number of
+     * pixels in this image must be exactly the same as the number of
+     * input neurons for this neural network.
      *
      * \return The output matrix resulting from
      * classifying/recognizing the input image.
      */
-    Matrix classify(const Matrix& inputs) const;
+    Vector classify(ConstView inputs) const;
+
+    /**
+     * Classifies an input like classify(), computing in a given
+     * workspace instead of allocating.
+     *
+     * \param[in] inputs The input image to be classified.
+     *
+     * \param[in,out] ws The scratch space to use.
+     *
+     * \return The outputs of the network, which live in \c ws until
+     * it is used again.
+     */
+    const Vector& classify(ConstView inputs, Workspace& ws) const;
+
+    /**
+     * Classifies a batch of inputs at once.  Each layer is computed
+     * for all the inputs with one matrix product, which is much
+     * faster than calling classify() for each input.
+     *
+     * \param[in] inputs The inputs to be classified, one per row,
+     * e.g., a range of samples of a dataset (see
+     * BasicDataset::inputBatch).
+     *
+     * \return The outputs of the network, one per column, i.e.,
+     * column j is classify(inputs.row(j).asColumn()).
+     */
+    Vector classifyBatch(ConstView inputs) const;
+
+    /**
+     * Classifies a batch of inputs like classifyBatch(), computing in a
+     * given workspace instead of allocating.
+     *
+     * \param[in] inputs The inputs to be classified, one per row.
+     *
+     * \param[in,out] ws The scratch space to use.
+     *
+     * \return The outputs of the network, one per column, which live
+     * in \c ws until it is used again.
+     */
+    const Vector& classifyBatch(ConstView inputs, Workspace& ws) const;
+
+    /** Returns the biases of each layer. */
+    const VectorList& getBiases() const { return biases; }
+
+    /** Returns the weights of each layer. */
+    const WeightList& getWeights() const { return weights; }
+
+    /**
+     * Replaces the biases and weights of this network, e.g., with
+     * values received from a parameter server.
+     *
+     * \param[in] newBiases The biases of each layer.  They must have
+     * the same dimensions as the current ones.
+     *
+     * \param[in] newWeights The weights of each layer.  They must have
+     * the same dimensions as the current ones.
+     */
+    void setParameters(const VectorList& newBiases,
+                       const WeightList& newWeights);
+
+    /** Returns the number of layers with weights (i.e., excluding
+        the input layer). */
+    size_t layerCount() const { return weights.size(); }
+
+    /** Returns the number of weights in layer \c lyr, which is
+        proportional to the cost of feedForward() for that layer. */
+    size_t weightCount(const size_t lyr) const { return weights[lyr].size(); }
+
+    /**
+     * Computes the outputs of one layer of this network.  Calling
+     * this method for layers 0 to layerCount() - 1, with the outputs
+     * of each layer as the inputs of the next, is the same as
+     * classify().
+     *
+     * \param[in] lyr The index of the layer, starting with 0 for the
+     * layer right after the inputs.
+     *
+     * \param[in] input The outputs of the previous layer, or the inputs
+     * to the network for layer 0.
+     *
+     * \return The outputs of the given layer.
+     */
+    Vector feedForward(size_t lyr, ConstView input) const;
 
     /**
      * This method is the top-level training method that processes
@@ -112,6 +489,75 @@ public:
     void train(const std::string& path);
 
 protected:
+    /**
+     * Computes the gradients of the cost for one sample with respect
+     * to the biases and weights of each layer via back propagation.
+     * This method only reads the weights and biases.
+     *
+     * \param[in] inputs The input to the network.
+     *
+     * \param[in] expected The expected output for the input.
+     *
+     * \param[in,out] ws The scratch space to use.  On return its \c
+     * nablaB and \c nablaW hold the gradients of the biases and
+     * weights of each layer, in the same order as the layers.
+     */
+    void backprop(ConstView inputs, ConstView expected, Workspace& ws) const;
+
+    /**
+     * Computes the sums of the gradients of the cost for a batch of
+     * samples, like backprop() for each sample, but with one matrix
+     * product per layer and pass.
+     *
+     * \param[in] inputs The inputs to the network, one per row.
+     *
+     * \param[in] expected The expected outputs, one per row.
+     *
+     * \param[in,out] ws The scratch space to use.  On return its \c
+     * nablaB and \c nablaW hold the sums of the gradients of the
+     * biases and weights of each layer over all the samples.
+     */
+    void backpropBatch(ConstView inputs, ConstView expected,
+                       Workspace& ws) const;
+
+    /**
+     * Computes the outputs of each layer for one input into the \c
+     * activations of a workspace.  Each layer is computed in one
+     * sweep by the fused dense-layer kernel (see Matrix::denseInto).
+     *
+     * \param[in] inputs The input to the network.
+     *
+     * \param[in,out] ws The scratch space to use.
+     */
+    void forward(ConstView inputs, Workspace& ws) const;
+
+    /**
+     * Computes the outputs of each layer for a batch of inputs into
+     * the \c activations of a workspace, with one sample per column.
+     *
+     * \param[in] inputs The inputs to the network, one per row.
+     *
+     * \param[in,out] ws The scratch space to use.
+     */
+    void forwardBatch(ConstView inputs, Workspace& ws) const;
+
+    /**
+     * The loop of each thread in trainHogwild(): claims the samples
+     * of \c data with indexes from \c next (atomically incremented)
+     * up to \c end and applies their gradients to this network
+     * without locking.
+     *
+     * \param[in] data The samples to learn from.
+     *
+     * \param[in,out] next The index of the next sample to be claimed.
+     *
+     * \param[in] end The index after the last sample to be learned.
+     *
+     * \param[in] eta The learning rate.
+     */
+    void hogwildLoop(const BasicDataset<T>& data, std::atomic<size_t>& next,
+                     size_t end, const T eta);
+
     /**
      * This is an internal helper method that is used to initializes
      * the biases and weights matrix values for each layer.  This
@@ -126,32 +572,24 @@ protected:
      *
      * \param[out] weights The list of weights for each layer to be
      * initialized by this method.
-     */
-    void initBiasAndWeightMatrices(const std::vector<int>& layerSizes,
-                                   MatrixVec& biases, MatrixVec& weights) const;
-
-    /**
-     * A simple sigmoid function.
-     *
-     * \param[in] val The value whose sigmoid value is to be returned.
      *
-     * \return The sigmoid value for the given val.
+     * \param[in] seed The seed of the pseudo-random weights.
      */
-    static Val sigmoid(const Val val) {
-        return 1. / (1. + std::exp(-val));
-    }
-
+    void initBiasAndWeightMatrices(const std::vector<int>& layerSizes,
+                                   VectorList& biases, WeightList& weights,
+                                   unsigned seed) const;
 
     /**
-     * A simple inverse-sigmoid function.
-     *
-     * \param[in] val The value whose inverse sigmoid value is to be
-     * returned.
+     * Returns the activation function of a layer, which computes the
+     * activations of a block of values in the accuracy tier of this
+     * network.
      *
-     * \return The inverse sigmoid value for the given val.
+     * \param[in] lyr The index of the layer.
      */
-    static Val invSigmoid(const Val val) {
-        return sigmoid(val) * (1 - sigmoid(val));
+    simd::ActivationFn<T> layerActivation(const size_t lyr) const {
+        return (lyr + 1 == weights.size()) ?
+            Output::template function<T>(accuracy) :
+            Hidden::template function<T>(accuracy);
     }
 
 private:
@@ -159,19 +597,38 @@ private:
      * The column-vector of biases associated with each layer of the
      * neural network.
      */
-    MatrixVec biases;
+    VectorList biases;
 
     /**
      * The two dimensional matrix of weights associated with each
      * layer of the neural network.
      */
-    MatrixVec weights;
+    WeightList weights;
 
     /**
      * The number of neurons to be present on each layer of the neural
      * network.
      */
-    Matrix layerSizes;
+    Vector layerSizes;
+
+    /** The accuracy tier of the activation functions. */
+    simd::Accuracy accuracy;
+
+    /** The scratch space used by learn() and learnBatch(). */
+    Workspace work;
+
+    /** The scratch space of each shard in trainParallel(). */
+    std::vector<Workspace> shardWork;
 };
 
+/** The default neural network, which computes and stores in Val. */
+using NeuralNet = BasicNeuralNet<Val>;
+
+#define NN_EXTERN_NEURAL_NET(T, W, H, O, L)                             \
+    extern template class BasicNeuralNet<T, W, H, O, L>;
+
+NN_FOR_EACH_NEURAL_NET(NN_EXTERN_NEURAL_NET)
+
+#undef NN_EXTERN_NEURAL_NET
+
 #endif
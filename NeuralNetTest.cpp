@@ -0,0 +1,106 @@
+/**
+ * A test that checks that networks created by the BasicNeuralNet
+ * constructor learn with every hidden activation policy in
+ * Activation.h.  Each network is trained on a small synthetic
+ * classification problem, and its mean quadratic error over the
+ * samples must fall to less than half of its initial value.
+ *
+ * Copyright (C) 2021 raodm@miamiOH.edu
+ */
+
+#include <cstdio>
+#include <random>
+#include "NeuralNet.h"
+
+/** The number of inputs of each sample. */
+constexpr int Inputs = 4;
+
+/** The number of classes (outputs) of each sample. */
+constexpr int Classes = 3;
+
+/**
+ * Returns the mean quadratic error of a network over a set of
+ * samples.
+ *
+ * \param[in] net The network to be checked.
+ *
+ * \param[in] inputs The inputs of the samples, one per row.
+ *
+ * \param[in] expected The expected outputs, one sample per row.
+ */
+template<typename Net>
+double meanError(const Net& net, const Matrix& inputs,
+                 const Matrix& expected) {
+    const Matrix outputs = net.classifyBatch(inputs);
+    double sum = 0;
+    for (size_t r = 0; (r < outputs.height()); r++) {
+        for (size_t j = 0; (j < outputs.width()); j++) {
+            const double diff = outputs.view()(r, j) -
+                expected.view()(j, r);
+            sum += diff * diff;
+        }
+    }
+    return sum / inputs.height();
+}
+
+/**
+ * Trains a network created by the constructor with mini-batches and
+ * checks that its error falls.
+ *
+ * \param[in] name The name of the policies for the report.
+ *
+ * \param[in] inputs The inputs of the samples, one per row.
+ *
+ * \param[in] expected The expected outputs, one sample per row.
+ *
+ * \return 1 if the network did not learn and 0 otherwise.
+ */
+template<typename Net>
+int check(const char* name, const Matrix& inputs, const Matrix& expected) {
+    Net net({Inputs, 16, 16, Classes});
+    const double before = meanError(net, inputs, expected);
+    for (int epoch = 0; (epoch < 100); epoch++) {
+        for (size_t i = 0; (i < inputs.height()); i += 10) {
+            net.learnBatch(inputs.rows(i, i + 10), expected.rows(i, i + 10),
+                           0.3);
+        }
+    }
+    const double after = meanError(net, inputs, expected);
+    const bool learned = (after < before / 2);
+    std::printf("%-28s error %.4f -> %.4f%s\n", name, before, after,
+                learned ? "" : "  FAILED");
+    return learned ? 0 : 1;
+}
+
+int main() {
+    // Each sample is one-hot encoded into the class given by the signs
+    // of (a combination of) its inputs.
+    const size_t count = 400;
+    Matrix inputs(count, Inputs), expected(count, Classes);
+    std::mt19937 rndGen(7);
+    for (size_t i = 0; (i < count); i++) {
+        const auto in = inputs.view().row(i);
+        for (int c = 0; (c < Inputs); c++) {
+            in(0, c) = 4.0 * rndGen() / 4294967296.0 - 2;
+        }
+        const int cls = (in(0, 0) + in(0, 1) > 0) + (in(0, 2) > 0.5);
+        for (int c = 0; (c < Classes); c++) {
+            expected.view()(i, c) = (c == cls);
+        }
+    }
+
+    using namespace activation;
+    int failures = 0;
+    failures += check<BasicNeuralNet<Val>>("sigmoid", inputs, expected);
+    failures += check<BasicNeuralNet<Val, Val, Tanh>>("tanh", inputs,
+                                                      expected);
+    failures += check<BasicNeuralNet<Val, Val, ReLU>>("relu", inputs,
+                                                      expected);
+    failures += check<BasicNeuralNet<Val, Val, LeakyReLU<>>>("leaky relu",
+                                                             inputs,
+                                                             expected);
+    failures += check<BasicNeuralNet<Val, Val, ReLU, Softmax,
+                                     loss::CrossEntropy>>(
+        "relu, softmax, cross-entropy", inputs, expected);
+    return (failures == 0) ? 0 : 1;
+}
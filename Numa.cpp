@@ -0,0 +1,223 @@
+// Copyright (C) 2021 raodm@miamioh.edu
+
+#ifndef NUMA_CPP
+#define NUMA_CPP
+
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include "Numa.h"
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+namespace numa {
+
+namespace {
+
+// The cores of each node that this process may use, and the node of
+// each core (-1 for cores that are not used).
+struct Topology {
+    std::vector<std::vector<int>> nodeCpus;
+    std::vector<int> cpuNode;
+};
+
+// The node of the calling thread once it was pinned, or -1.
+thread_local int pinnedNode = -1;
+
+// Parses a sysfs list such as "0-3,8,10-11" into its numbers.
+std::vector<int> parseList(const std::string& list) {
+    std::vector<int> values;
+    std::istringstream is(list);
+    std::string range;
+    while (std::getline(is, range, ',')) {
+        if (range.empty()) {
+            continue;
+        }
+        const size_t dash = range.find('-');
+        const int first = std::stoi(range.substr(0, dash));
+        const int last  = (dash == std::string::npos) ? first :
+            std::stoi(range.substr(dash + 1));
+        for (int value = first; (value <= last); value++) {
+            values.push_back(value);
+        }
+    }
+    return values;
+}
+
+// Returns the first line of a file, or "" if it cannot be read.
+std::string readLine(const std::string& path) {
+    std::ifstream is(path);
+    std::string line;
+    std::getline(is, line);
+    return line;
+}
+
+// Reads the topology from sysfs.  Anything unexpected results in a
+// single node.
+Topology readTopology() {
+    Topology topo;
+#ifdef __linux__
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    const bool haveMask =
+        (sched_getaffinity(0, sizeof(allowed), &allowed) == 0);
+    const std::string sysfs = "/sys/devices/system/node/";
+    try {
+        for (const int node : parseList(readLine(sysfs + "online"))) {
+            std::vector<int> cpus;
+            const std::string path = sysfs + "node" + std::to_string(node) +
+                "/cpulist";
+            for (const int cpu : parseList(readLine(path))) {
+                if ((cpu >= 0) && (cpu < CPU_SETSIZE) &&
+                    (!haveMask || CPU_ISSET(cpu, &allowed))) {
+                    cpus.push_back(cpu);
+                }
+            }
+            // Nodes without usable cores (e.g., memory-only nodes)
+            // cannot run threads, so they are ignored.
+            if (!cpus.empty()) {
+                topo.nodeCpus.push_back(cpus);
+            }
+        }
+    } catch (const std::exception&) {
+        topo.nodeCpus.clear();
+    }
+#endif
+    if (topo.nodeCpus.size() <= 1) {
+        // One node: the exact cores do not matter, since nothing is
+        // pinned in this case.
+        topo.nodeCpus.assign(1, std::vector<int>{0});
+    }
+    for (size_t node = 0; (node < topo.nodeCpus.size()); node++) {
+        for (const int cpu : topo.nodeCpus[node]) {
+            if (cpu >= int(topo.cpuNode.size())) {
+                topo.cpuNode.resize(cpu + 1, -1);
+            }
+            topo.cpuNode[cpu] = node;
+        }
+    }
+    return topo;
+}
+
+// Returns the topology, reading it on first use.
+const Topology& topology() {
+    static const Topology topo = readTopology();
+    return topo;
+}
+
+// Returns the value of a numeric environment variable, or a default
+// if it is not set (or not positive).
+size_t fromEnv(const char* name, const size_t defValue) {
+    const char* env = std::getenv(name);
+    const long value = (env == nullptr) ? 0 : std::strtol(env, nullptr, 10);
+    return (value > 0) ? value : defValue;
+}
+
+#ifdef __linux__
+// Pins the calling thread to a set of cores.
+bool pinTo(const std::vector<int>& cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (const int cpu : cpus) {
+        CPU_SET(cpu, &set);
+    }
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+#endif
+
+}  // namespace
+
+size_t nodeCount() {
+    return topology().nodeCpus.size();
+}
+
+bool enabled() {
+    static const bool requested = (fromEnv("NN_NUMA", 0) != 0);
+    return requested && (nodeCount() > 1);
+}
+
+const std::vector<int>& cpus(const size_t node) {
+    return topology().nodeCpus.at(node);
+}
+
+int cpuForThread(const size_t i) {
+    const std::vector<int>& nodeCpus = cpus(i % nodeCount());
+    return nodeCpus[(i / nodeCount()) % nodeCpus.size()];
+}
+
+bool pinToCpu(const int cpu) {
+#ifdef __linux__
+    const Topology& topo = topology();
+    if ((cpu >= 0) && (cpu < int(topo.cpuNode.size())) &&
+        (topo.cpuNode[cpu] >= 0) && pinTo({cpu})) {
+        pinnedNode = topo.cpuNode[cpu];
+        return true;
+    }
+#endif
+    return false;
+}
+
+size_t currentNode() {
+    if (pinnedNode >= 0) {
+        return pinnedNode;
+    }
+    if (nodeCount() == 1) {
+        return 0;
+    }
+#ifdef __linux__
+    const std::vector<int>& cpuNode = topology().cpuNode;
+    const int cpu = sched_getcpu();
+    if ((cpu >= 0) && (cpu < int(cpuNode.size())) && (cpuNode[cpu] >= 0)) {
+        return cpuNode[cpu];
+    }
+#endif
+    return 0;
+}
+
+void forEachNode(const std::function<void(size_t node)>& fn) {
+    if (nodeCount() == 1) {
+        fn(0);
+        return;
+    }
+    std::exception_ptr error;
+    std::mutex errorLock;
+    std::vector<std::thread> threads;
+    for (size_t node = 0; (node < nodeCount()); node++) {
+        threads.emplace_back([&, node] {
+#ifdef __linux__
+            if (pinTo(cpus(node))) {
+                pinnedNode = node;
+            }
+#endif
+            try {
+                fn(node);
+            } catch (...) {
+                std::lock_guard<std::mutex> guard(errorLock);
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+size_t syncInterval() {
+    static const size_t interval = fromEnv("NN_NUMA_SYNC", 1024);
+    return interval;
+}
+
+}  // namespace numa
+
+#endif
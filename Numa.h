@@ -0,0 +1,165 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+/** \file Numa.h NUMA-aware thread placement and data replication.
+
+    On machines with several NUMA nodes (e.g., dual-socket hosts) each
+    node has its own memory, and a core reads memory attached to
+    another node much more slowly than its own.  Linux places a page
+    on the node of the thread that first writes it ("first touch"),
+    so data initialized by the main thread ends up on one node and
+    half the cores of a dual-socket host read it remotely.
+
+    This file provides a NUMA-aware execution mode that is enabled by
+    setting the \c NN_NUMA environment variable to 1.  In this mode:
+
+    <ul>
+    <li>The workers of ThreadPool::global() are pinned to cores,
+    spread round-robin over the nodes (see numa::cpuForThread).</li>
+
+    <li>Read-mostly data can be replicated on every node via
+    NodeReplicas, whose copies are made by threads pinned to the
+    owning node so that their pages are first touched there.  Tasks
+    then use the copy of the node they run on (NodeReplicas::local).
+    Inference replicates the network, and training replicates the
+    decoded dataset (see BasicNeuralNet::trainHogwild).</li>
+    </ul>
+
+    The topology is read from sysfs and restricted to the cores the
+    process may run on.  On machines (or containers) with a single
+    node, and on platforms other than Linux, numa::enabled() is always
+    false and everything behaves as without \c NN_NUMA.
+
+    Copyright (C) 2021 raodm@miamiOH.edu
+*/
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace numa {
+
+/** Returns the number of NUMA nodes with cores this process may use
+    (at least 1). */
+size_t nodeCount();
+
+/** Returns true if the NUMA-aware mode was requested via the \c
+    NN_NUMA environment variable and there is more than one node. */
+bool enabled();
+
+/**
+ * Returns the cores (CPU numbers) of a node that this process may use.
+ *
+ * \param[in] node The index of the node, in [0, nodeCount()).
+ */
+const std::vector<int>& cpus(size_t node);
+
+/**
+ * Returns the core on which the i-th of several pinned threads should
+ * run.  Consecutive threads go to different nodes (round-robin), so
+ * any number of threads is spread evenly over the nodes.
+ *
+ * \param[in] i The index of the thread.
+ */
+int cpuForThread(size_t i);
+
+/**
+ * Pins the calling thread to one core.
+ *
+ * \param[in] cpu The core, e.g., from cpuForThread().
+ *
+ * \return True if the thread was pinned.
+ */
+bool pinToCpu(int cpu);
+
+/**
+ * Returns the node of the core the calling thread runs on.  This is
+ * exact for pinned threads and a best guess for other threads, which
+ * the kernel may move at any time.  Always 0 on a single node.
+ */
+size_t currentNode();
+
+/**
+ * Calls fn(node) for every node, each on a temporary thread pinned to
+ * the cores of that node, so that memory first touched by \c fn is
+ * placed on the node.  The calls run concurrently and this function
+ * returns once all of them are done.  With a single node, fn(0) is
+ * simply called on the calling thread.
+ *
+ * \param[in] fn The function to call.  If it throws for any node, the
+ * first such exception is rethrown here.
+ */
+void forEachNode(const std::function<void(size_t node)>& fn);
+
+/**
+ * Returns the number of samples that each node trains on between
+ * synchronizations of its replica of the network in NUMA-aware
+ * training.  Set via the \c NN_NUMA_SYNC environment variable
+ * (default 1024).
+ */
+size_t syncInterval();
+
+}  // namespace numa
+
+/**
+ * One copy of a value per NUMA node, each allocated and initialized
+ * on its node.  See the file comment for details.
+ *
+ * \code
+ * const NodeReplicas<NeuralNet> nets(net);
+ * group.run([&] { nets.local().classifyBatch(inputs); });
+ * \endcode
+ *
+ * \tparam T The type of the value.  It must be copy constructible
+ * and copy assignable.
+ */
+template<typename T>
+class NodeReplicas {
+public:
+    /**
+     * Creates a copy of a value on each node.
+     *
+     * \param[in] source The value to be copied.  It is read
+     * concurrently by one thread per node.
+     */
+    explicit NodeReplicas(const T& source) : replicas(numa::nodeCount()) {
+        numa::forEachNode([&](const size_t node) {
+            replicas[node].reset(new T(source));
+        });
+    }
+
+    /** Returns the number of copies, i.e., numa::nodeCount(). */
+    size_t size() const { return replicas.size(); }
+
+    /** Returns the copy on a given node. */
+    T& operator[](const size_t node) { return *replicas[node]; }
+
+    /** Returns the copy on a given node. */
+    const T& operator[](const size_t node) const { return *replicas[node]; }
+
+    /** Returns the copy on the node of the calling thread. */
+    T& local() { return *replicas[numa::currentNode()]; }
+
+    /** Returns the copy on the node of the calling thread. */
+    const T& local() const { return *replicas[numa::currentNode()]; }
+
+    /**
+     * Overwrites every copy with a value.  Each copy is assigned by a
+     * thread on its node, so copies whose storage is reused by the
+     * assignment (e.g., matrices of the same size) stay on their node.
+     *
+     * \param[in] source The value to be copied.
+     */
+    void sync(const T& source) {
+        numa::forEachNode([&](const size_t node) {
+            *replicas[node] = source;
+        });
+    }
+
+private:
+    /** The copy for each node. */
+    std::vector<std::unique_ptr<T>> replicas;
+};
+
+#endif
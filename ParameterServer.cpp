@@ -0,0 +1,527 @@
+// Copyright (C) 2021 raodm@miamioh.edu
+
+#ifndef PARAMETER_SERVER_CPP
+#define PARAMETER_SERVER_CPP
+
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include "ParameterServer.h"
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+// The types of messages exchanged between workers and the server.
+// Each message is a header (the type and the size of the payload)
+// followed by the payload.
+enum class Message : uint32_t { Pull = 1, Push = 2, Done = 3, Params = 4 };
+
+// Flags for send() so that writing to a closed socket reports an
+// error instead of raising SIGPIPE.
+#ifdef MSG_NOSIGNAL
+constexpr int SendFlags = MSG_NOSIGNAL;
+#else
+constexpr int SendFlags = 0;
+#endif
+
+// Throws an exception describing a failed system call.
+[[noreturn]] void fail(const std::string& what) {
+    throw std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+// ----------------------[ Binary encoding ]-----------------------------
+
+// Appends values to a message payload.
+class Encoder {
+public:
+    template<typename T>
+    void put(const T& value) {
+        const char* bytes = reinterpret_cast<const char*>(&value);
+        buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+    }
+
+    // Appends a list of matrices: the count, and then the rows,
+    // columns, and unpadded values of each matrix.
+    void put(const MatrixVec& matrices) {
+        put<uint32_t>(matrices.size());
+        for (const auto& matrix : matrices) {
+            put<uint32_t>(matrix.height());
+            put<uint32_t>(matrix.width());
+            for (size_t r = 0; (r < matrix.height()); r++) {
+                const char* row = reinterpret_cast<const char*>(
+                    matrix.data() + r * matrix.pitch());
+                buffer.insert(buffer.end(), row,
+                              row + matrix.width() * sizeof(Val));
+            }
+        }
+    }
+
+    std::vector<char> buffer;
+};
+
+// Reads values from a message payload, checking that the payload is
+// long enough.
+class Decoder {
+public:
+    explicit Decoder(const std::vector<char>& buffer) : buffer(buffer) {}
+
+    template<typename T>
+    T get() {
+        T value;
+        std::memcpy(&value, take(sizeof(T)), sizeof(T));
+        return value;
+    }
+
+    // Reads a list of matrices, which must have the same count and
+    // dimensions as a given list.
+    MatrixVec getMatrices(const MatrixVec& shapes) {
+        if (get<uint32_t>() != shapes.size()) {
+            throw std::runtime_error("Unexpected number of matrices");
+        }
+        MatrixVec matrices;
+        for (const auto& shape : shapes) {
+            const size_t rows = get<uint32_t>(), cols = get<uint32_t>();
+            if ((rows != shape.height()) || (cols != shape.width())) {
+                throw std::runtime_error("Unexpected matrix dimensions");
+            }
+            matrices.emplace_back(rows, cols);
+            std::memcpy(matrices.back().data(), take(rows * cols * sizeof(Val)),
+                        rows * cols * sizeof(Val));
+        }
+        return matrices;
+    }
+
+private:
+    const char* take(const size_t bytes) {
+        if (buffer.size() - pos < bytes) {
+            throw std::runtime_error("Truncated message");
+        }
+        pos += bytes;
+        return buffer.data() + pos - bytes;
+    }
+
+    const std::vector<char>& buffer;
+    size_t pos = 0;
+};
+
+// ------------------------[ Socket helpers ]----------------------------
+
+// Writes all the given bytes to a socket.
+void writeAll(const int fd, const char* data, size_t bytes) {
+    while (bytes > 0) {
+        const ssize_t sent = send(fd, data, bytes, SendFlags);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fail("Error writing to socket");
+        }
+        data  += sent;
+        bytes -= sent;
+    }
+}
+
+// Reads exactly the given number of bytes from a socket.  Returns
+// false if the connection was closed before any byte was read.
+bool readAll(const int fd, char* data, const size_t bytes) {
+    for (size_t done = 0; (done < bytes);) {
+        const ssize_t got = recv(fd, data + done, bytes - done, 0);
+        if ((got < 0) && (errno == EINTR)) {
+            continue;
+        } else if (got < 0) {
+            fail("Error reading from socket");
+        } else if (got == 0) {
+            if (done == 0) {
+                return false;
+            }
+            throw std::runtime_error("Connection closed mid-message");
+        }
+        done += got;
+    }
+    return true;
+}
+
+// Sends a message with the given type and payload.
+void sendMessage(const int fd, const Message type,
+                 const std::vector<char>& payload = {}) {
+    Encoder header;
+    header.put(static_cast<uint32_t>(type));
+    header.put<uint64_t>(payload.size());
+    writeAll(fd, header.buffer.data(), header.buffer.size());
+    writeAll(fd, payload.data(), payload.size());
+}
+
+// Receives a message.  Returns false if the connection was closed.
+bool receiveMessage(const int fd, Message& type, std::vector<char>& payload) {
+    char header[sizeof(uint32_t) + sizeof(uint64_t)];
+    if (!readAll(fd, header, sizeof(header))) {
+        return false;
+    }
+    uint32_t kind;
+    uint64_t size;
+    std::memcpy(&kind, header, sizeof(kind));
+    std::memcpy(&size, header + sizeof(kind), sizeof(size));
+    type = static_cast<Message>(kind);
+    payload.resize(size);
+    if ((size > 0) && !readAll(fd, payload.data(), size)) {
+        throw std::runtime_error("Connection closed mid-message");
+    }
+    return true;
+}
+
+// A parsed socket address: either "unix:path" or "tcp:host:port".
+struct Address {
+    explicit Address(const std::string& address) {
+        const size_t colon = address.find(':');
+        const std::string scheme = address.substr(0, colon);
+        if ((colon != std::string::npos) && (scheme == "unix")) {
+            local = true;
+            path  = address.substr(colon + 1);
+            return;
+        }
+        const size_t portColon = address.rfind(':');
+        if ((scheme != "tcp") || (portColon == colon)) {
+            throw std::runtime_error("Invalid address: " + address +
+                                     " (use unix:path or tcp:host:port)");
+        }
+        host = address.substr(colon + 1, portColon - colon - 1);
+        port = address.substr(portColon + 1);
+    }
+
+    // Fills in a Unix domain socket address.
+    sockaddr_un unixAddress() const {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path)) {
+            throw std::runtime_error("Socket path too long: " + path);
+        }
+        std::strcpy(addr.sun_path, path.c_str());
+        return addr;
+    }
+
+    // Resolves a TCP address.  The caller must free the result.
+    addrinfo* resolve(const bool passive) const {
+        addrinfo hints{}, *result = nullptr;
+        hints.ai_family   = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags    = passive ? AI_PASSIVE : 0;
+        const int err = getaddrinfo(host.empty() ? nullptr : host.c_str(),
+                                    port.c_str(), &hints, &result);
+        if (err != 0) {
+            throw std::runtime_error("Cannot resolve " + host + ": " +
+                                     gai_strerror(err));
+        }
+        return result;
+    }
+
+    bool local = false;
+    std::string path, host, port;
+};
+
+// Disables Nagle's algorithm on TCP sockets, since every message is
+// a complete request or reply that should be sent at once.
+void setNoDelay(const int fd) {
+    const int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+// Creates a socket listening at a given address.
+int listenAt(const Address& address) {
+    int fd = -1;
+    if (address.local) {
+        const sockaddr_un addr = address.unixAddress();
+        unlink(address.path.c_str());  // Remove a stale socket file.
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if ((fd < 0) || (bind(fd, reinterpret_cast<const sockaddr*>(&addr),
+                              sizeof(addr)) != 0)) {
+            fail("Cannot bind to " + address.path);
+        }
+    } else {
+        addrinfo* info = address.resolve(true);
+        fd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+        const int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        const bool bound = (fd >= 0) &&
+            (bind(fd, info->ai_addr, info->ai_addrlen) == 0);
+        freeaddrinfo(info);
+        if (!bound) {
+            fail("Cannot bind to port " + address.port);
+        }
+    }
+    if (listen(fd, SOMAXCONN) != 0) {
+        fail("Cannot listen");
+    }
+    return fd;
+}
+
+// Tries once to connect to a given address.  Returns -1 on failure.
+int tryConnect(const Address& address) {
+    int fd = -1;
+    if (address.local) {
+        const sockaddr_un addr = address.unixAddress();
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if ((fd >= 0) && (connect(fd, reinterpret_cast<const sockaddr*>(&addr),
+                                  sizeof(addr)) != 0)) {
+            close(fd);
+            fd = -1;
+        }
+        return fd;
+    }
+    addrinfo* info = address.resolve(false);
+    for (addrinfo* ai = info; (ai != nullptr) && (fd < 0); ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if ((fd >= 0) && (connect(fd, ai->ai_addr, ai->ai_addrlen) != 0)) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(info);
+    if (fd >= 0) {
+        setNoDelay(fd);
+    }
+    return fd;
+}
+
+// Encodes the reply with the current parameters.
+std::vector<char> encodeParams(const uint64_t version, const bool accepted,
+                               const MatrixVec& biases,
+                               const MatrixVec& weights) {
+    Encoder params;
+    params.put(version);
+    params.put<uint8_t>(accepted);
+    params.put(biases);
+    params.put(weights);
+    return params.buffer;
+}
+
+// Adds scale * delta to each of the given parameters.
+void addDelta(MatrixVec& params, const MatrixVec& delta, const Val scale) {
+    for (size_t i = 0; (i < params.size()); i++) {
+        params[i].axpy(scale, delta[i]);
+    }
+}
+
+}  // namespace
+
+// ------------------------[ ParameterServer ]---------------------------
+
+ParameterServer::ParameterServer(NeuralNet& net, const Options& options) :
+    net(net), options(options) {
+}
+
+void
+ParameterServer::serve(const std::string& address) {
+    const Address addr(address);
+    const int listener = listenAt(addr);
+    MatrixVec biases = net.getBiases(), weights = net.getWeights();
+
+    // The connected workers.  A worker is waiting if it pushed a delta
+    // for the current synchronous round.
+    struct Worker {
+        int fd;
+        bool waiting;
+    };
+    std::vector<Worker> workers;
+    size_t accepted = 0, finished = 0;
+
+    // The sum of the deltas of the current synchronous round.
+    MatrixVec sumB, sumW;
+    size_t roundSize = 0;
+
+    // Applies the average delta of a synchronous round once all the
+    // workers that have not finished have pushed theirs.
+    const auto finishRound = [&] {
+        if ((roundSize == 0) || (roundSize < options.workers - finished)) {
+            return;
+        }
+        addDelta(biases, sumB, Val(1) / roundSize);
+        addDelta(weights, sumW, Val(1) / roundSize);
+        updates++;
+        roundSize = 0;
+        const auto reply = encodeParams(updates, true, biases, weights);
+        for (auto& worker : workers) {
+            if (worker.waiting) {
+                sendMessage(worker.fd, Message::Params, reply);
+                worker.waiting = false;
+            }
+        }
+    };
+
+    std::vector<char> payload;
+    while (finished < options.workers) {
+        // Wait for a new connection or a message from a worker.
+        std::vector<pollfd> fds;
+        if (accepted < options.workers) {
+            fds.push_back({listener, POLLIN, 0});
+        }
+        for (const auto& worker : workers) {
+            fds.push_back({worker.fd, POLLIN, 0});
+        }
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fail("Error waiting for workers");
+        }
+
+        for (const auto& ready : fds) {
+            if (ready.revents == 0) {
+                continue;
+            } else if (ready.fd == listener) {
+                const int fd = accept(listener, nullptr, nullptr);
+                if (fd < 0) {
+                    fail("Error accepting a worker");
+                }
+                if (!addr.local) {
+                    setNoDelay(fd);
+                }
+                workers.push_back({fd, false});
+                accepted++;
+                continue;
+            }
+            auto worker = std::find_if(workers.begin(), workers.end(),
+                                       [&](const Worker& w) {
+                                           return w.fd == ready.fd; });
+            Message type;
+            if (!receiveMessage(worker->fd, type, payload) ||
+                (type == Message::Done)) {
+                // The worker is finished (or has disconnected).
+                close(worker->fd);
+                workers.erase(worker);
+                finished++;
+                if (options.mode == UpdateMode::Sync) {
+                    finishRound();
+                }
+            } else if (type == Message::Pull) {
+                sendMessage(worker->fd, Message::Params,
+                            encodeParams(updates, true, biases, weights));
+            } else if (type == Message::Push) {
+                Decoder push(payload);
+                const uint64_t base = push.get<uint64_t>();
+                const MatrixVec deltaB = push.getMatrices(biases);
+                const MatrixVec deltaW = push.getMatrices(weights);
+                if (options.mode == UpdateMode::Async) {
+                    // Apply the delta unless it is too stale.
+                    const bool fresh = (updates - base <= options.maxStaleness);
+                    if (fresh) {
+                        addDelta(biases, deltaB, 1);
+                        addDelta(weights, deltaW, 1);
+                        updates++;
+                    }
+                    sendMessage(worker->fd, Message::Params,
+                                encodeParams(updates, fresh, biases, weights));
+                } else {
+                    // Add the delta to the round and reply when it ends.
+                    if (roundSize++ == 0) {
+                        sumB = deltaB;
+                        sumW = deltaW;
+                    } else {
+                        addDelta(sumB, deltaB, 1);
+                        addDelta(sumW, deltaW, 1);
+                    }
+                    worker->waiting = true;
+                    finishRound();
+                }
+            } else {
+                throw std::runtime_error("Unexpected message from worker");
+            }
+        }
+    }
+
+    close(listener);
+    if (addr.local) {
+        unlink(addr.path.c_str());
+    }
+    net.setParameters(biases, weights);
+}
+
+// ------------------------[ ParameterClient ]---------------------------
+
+ParameterClient::ParameterClient(const std::string& address,
+                                 const int timeoutMillis) {
+    const Address addr(address);
+    const auto deadline = std::chrono::steady_clock::now() +
+        std::chrono::milliseconds(timeoutMillis);
+    // The server may not be listening yet, so keep trying for a while.
+    while ((fd = tryConnect(addr)) < 0) {
+        if (std::chrono::steady_clock::now() >= deadline) {
+            fail("Cannot connect to " + address);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+}
+
+ParameterClient::~ParameterClient() {
+    try {
+        done();
+    } catch (const std::exception&) {
+        // The server may already be gone; nothing more to do.
+    }
+}
+
+void
+ParameterClient::pull(NeuralNet& net) {
+    sendMessage(fd, Message::Pull);
+    receive(net);
+}
+
+bool
+ParameterClient::push(NeuralNet& net, const MatrixVec& baseBiases,
+                      const MatrixVec& baseWeights) {
+    // The delta is the change made by local training.
+    MatrixVec deltaB, deltaW;
+    for (size_t lyr = 0; (lyr < net.layerCount()); lyr++) {
+        deltaB.push_back(net.getBiases()[lyr] - baseBiases[lyr]);
+        deltaW.push_back(net.getWeights()[lyr] - baseWeights[lyr]);
+    }
+    Encoder push;
+    push.put(version);
+    push.put(deltaB);
+    push.put(deltaW);
+    sendMessage(fd, Message::Push, push.buffer);
+    return receive(net);
+}
+
+void
+ParameterClient::done() {
+    if (fd >= 0) {
+        const int sock = fd;
+        fd = -1;
+        try {
+            sendMessage(sock, Message::Done);
+        } catch (...) {
+            close(sock);
+            throw;
+        }
+        close(sock);
+    }
+}
+
+bool
+ParameterClient::receive(NeuralNet& net) {
+    Message type;
+    std::vector<char> payload;
+    if (!receiveMessage(fd, type, payload) || (type != Message::Params)) {
+        throw std::runtime_error("Expected parameters from server");
+    }
+    Decoder params(payload);
+    version = params.get<uint64_t>();
+    const bool accepted = params.get<uint8_t>();
+    const MatrixVec biases  = params.getMatrices(net.getBiases());
+    const MatrixVec weights = params.getMatrices(net.getWeights());
+    net.setParameters(biases, weights);
+    return accepted;
+}
+
+#endif
@@ -0,0 +1,183 @@
+#ifndef PARAMETER_SERVER_H
+#define PARAMETER_SERVER_H
+
+/** \file ParameterServer.h Distributed training via a parameter server.
+
+    This file contains a parameter server that owns the biases and
+    weights of a NeuralNet, and a client used by worker processes
+    that train on shards of the data.  A worker repeatedly trains a
+    local copy of the network on a batch of its shard, pushes the
+    resulting change (delta) of the parameters to the server, and
+    receives the current parameters in reply.  The server supports:
+
+    <ul>
+    <li>Synchronous updates (UpdateMode::Sync): the server waits for a
+    delta from every active worker, applies their average once, and
+    then replies to all of them with the same new parameters.  This
+    behaves like training with a batch that is the sum of the
+    workers' batches, independent of timing.</li>
+
+    <li>Asynchronous updates with bounded staleness
+    (UpdateMode::Async): each delta is applied as soon as it arrives,
+    provided it was computed from parameters at most \c maxStaleness
+    updates old.  Older (stale) deltas are discarded and the worker
+    simply continues from the current parameters.  Workers never wait
+    for each other, but the result depends on timing.</li>
+    </ul>
+
+    Processes communicate over stream sockets, with addresses of the
+    form <tt>unix:/path/to/socket</tt> for a Unix domain socket or
+    <tt>tcp:host:port</tt> for TCP, so the server and the workers can
+    run on one machine (e.g., for testing) or on several.  Matrices
+    are sent in a compact binary encoding: a count of matrices,
+    followed by the rows, columns, and unpadded values of each matrix
+    in the native byte order, so all processes must run on machines
+    with the same byte order.
+
+    Copyright (C) 2021 raodm@miamiOH.edu
+*/
+
+#include <cstdint>
+#include <string>
+#include "NeuralNet.h"
+
+/** The ways in which a ParameterServer applies updates. */
+enum class UpdateMode { Sync, Async };
+
+/**
+ * The server that owns the parameters of a network during distributed
+ * training.  See the file comment for details.
+ */
+class ParameterServer {
+public:
+    /** The settings of a server. */
+    struct Options {
+        /** The number of worker processes that will connect. */
+        size_t workers = 1;
+
+        /** How the deltas from workers are applied. */
+        UpdateMode mode = UpdateMode::Sync;
+
+        /** In Async mode, the maximum number of updates applied after
+            the parameters from which an accepted delta was
+            computed. */
+        size_t maxStaleness = 0;
+    };
+
+    /**
+     * Creates a server for the parameters of a network.
+     *
+     * \param[in,out] net The network whose biases and weights are the
+     * initial parameters.  It receives the trained parameters at the
+     * end of serve().
+     *
+     * \param[in] options The settings of this server.
+     */
+    ParameterServer(NeuralNet& net, const Options& options);
+
+    /**
+     * Listens at a given address and serves the workers until all of
+     * them have finished (or disconnected).
+     *
+     * \param[in] address The address to listen at, either
+     * <tt>unix:path</tt> or <tt>tcp:host:port</tt>.
+     *
+     * \exception std::runtime_error If the address cannot be used, or
+     * if a worker sends a malformed message.
+     */
+    void serve(const std::string& address);
+
+    /** Returns the number of updates applied to the parameters. */
+    uint64_t version() const { return updates; }
+
+private:
+    /** The network whose parameters are served. */
+    NeuralNet& net;
+
+    /** The settings of this server. */
+    const Options options;
+
+    /** The number of updates applied so far. */
+    uint64_t updates = 0;
+};
+
+/**
+ * The connection of a worker process to a ParameterServer.
+ *
+ * \code
+ * ParameterClient client("tcp:localhost:5555");
+ * client.pull(net);
+ * for (each batch) {
+ *     MatrixVec biases = net.getBiases(), weights = net.getWeights();
+ *     train net on the batch;
+ *     client.push(net, biases, weights);
+ * }
+ * \endcode
+ */
+class ParameterClient {
+public:
+    /**
+     * Connects to a server, retrying for a while in case the server
+     * has not started listening yet.
+     *
+     * \param[in] address The address of the server (see
+     * ParameterServer::serve).
+     *
+     * \param[in] timeoutMillis How long to keep retrying.
+     *
+     * \exception std::runtime_error If no connection could be made.
+     */
+    explicit ParameterClient(const std::string& address,
+                             int timeoutMillis = 10000);
+
+    /** Tells the server that this worker is done (if done() was not
+        called) and closes the connection. */
+    ~ParameterClient();
+
+    ParameterClient(const ParameterClient&) = delete;
+    ParameterClient& operator=(const ParameterClient&) = delete;
+
+    /**
+     * Replaces the parameters of a network with those of the server.
+     *
+     * \param[out] net The network to be updated.
+     */
+    void pull(NeuralNet& net);
+
+    /**
+     * Sends the change in the parameters of a network since the given
+     * (last received) parameters to the server, and replaces the
+     * parameters of the network with those of the server.  In Sync
+     * mode this waits until all the workers have pushed their deltas.
+     *
+     * \param[in,out] net The locally trained network, which receives
+     * the current parameters of the server.
+     *
+     * \param[in] baseBiases The biases that the network had before
+     * it was trained locally.
+     *
+     * \param[in] baseWeights The weights that the network had before
+     * it was trained locally.
+     *
+     * \return True if the delta was applied, and false if the server
+     * discarded it as stale.
+     */
+    bool push(NeuralNet& net, const MatrixVec& baseBiases,
+              const MatrixVec& baseWeights);
+
+    /** Tells the server that this worker will not push any more. */
+    void done();
+
+private:
+    /** Receives parameters from the server into a network and returns
+        whether the last push (if any) was accepted. */
+    bool receive(NeuralNet& net);
+
+    /** The socket connected to the server, or -1 after done(). */
+    int fd = -1;
+
+    /** The version of the parameters last received. */
+    uint64_t version = 0;
+};
+
+#endif
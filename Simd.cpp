@@ -0,0 +1,582 @@
+// Copyright (C) 2021 raodm@miamioh.edu
+
+#ifndef SIMD_CPP
+#define SIMD_CPP
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include "Float16.h"
+#include "Gemm.h"
+#include "Simd.h"
+
+// The vector kernels below are written once using GCC/Clang vector
+// extensions and then compiled for several instruction sets via the
+// target attribute.  The shared bodies are forced inline so that they
+// are code-generated with the instruction set of their caller.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define NN_SIMD_X86 1
+#endif
+
+#define NN_ALWAYS_INLINE inline __attribute__((always_inline))
+
+namespace simd {
+
+namespace {
+
+// The element-wise binary operations supported by binaryBody.
+enum BinaryOp { OpAdd, OpSub, OpMul };
+
+// The functions supported by activationBody.
+enum ActivationOp { ActExp, ActSigmoid, ActTanh };
+
+// Degrees of the polynomials for e^r - 1 used by the approximate
+// accuracy tiers.  The truncation errors of the Taylor polynomials
+// for |r| <= ln(2) / 2 are about 1e-8 and 1e-4, respectively.
+constexpr int HighDegree = 7;
+constexpr int FastDegree = 4;
+
+// The quotient in tanh roughly triples the error of its exponential,
+// so the Fast tier uses one more degree for tanh to stay within 1e-4.
+constexpr int tanhDegree(const int degree) {
+    return (degree == FastDegree) ? (FastDegree + 1) : degree;
+}
+
+// A vector of W values of type T.
+template<typename T, size_t W>
+struct Vec {
+    typedef T type __attribute__((vector_size(W * sizeof(T))));
+};
+
+// Combines two values (scalars or vectors) using the given operation.
+template<int Op, typename V>
+NN_ALWAYS_INLINE void combine(V& res, const V& x, const V& y) {
+    if (Op == OpAdd) {
+        res = x + y;
+    } else if (Op == OpSub) {
+        res = x - y;
+    } else {
+        res = x * y;
+    }
+}
+
+// ----------------------[ Portable scalar kernels ]---------------------
+// These kernels are also used for element types that have no vector
+// variants (such as BFloat16), so sums are kept in AccumT<T>.
+
+template<typename T, int Op>
+void binaryScalar(const T* x, const T* y, T* out, const size_t n) {
+    for (size_t i = 0; (i < n); i++) {
+        combine<Op>(out[i], x[i], y[i]);
+    }
+}
+
+template<typename T>
+void scaleScalar(const T* x, const T alpha, T* out, const size_t n) {
+    for (size_t i = 0; (i < n); i++) {
+        out[i] = x[i] * alpha;
+    }
+}
+
+template<typename T>
+void axpyScalar(const T alpha, const T* x, T* y, const size_t n) {
+    for (size_t i = 0; (i < n); i++) {
+        y[i] = y[i] + alpha * x[i];
+    }
+}
+
+template<typename T>
+T dotScalar(const T* x, const T* y, const size_t n) {
+    AccumT<T> sum = 0;
+    for (size_t i = 0; (i < n); i++) {
+        sum += x[i] * y[i];
+    }
+    return sum;
+}
+
+template<typename T>
+void microKernelScalar(const size_t kc, const T* a, const T* b, T* c,
+                       const size_t ldc, const size_t mr, const size_t nr,
+                       const bool accumulate) {
+    AccumT<T> acc[gemm::MR][gemm::NR] = {};
+    for (size_t p = 0; (p < kc); p++, a += gemm::MR, b += gemm::NR) {
+        for (size_t i = 0; (i < gemm::MR); i++) {
+            for (size_t j = 0; (j < gemm::NR); j++) {
+                acc[i][j] += a[i] * b[j];
+            }
+        }
+    }
+    for (size_t i = 0; (i < mr); i++) {
+        T* row = c + i * ldc;
+        for (size_t j = 0; (j < nr); j++) {
+            row[j] = accumulate ? (row[j] + acc[i][j]) : acc[i][j];
+        }
+    }
+}
+
+// The reference activation functions, using libm.
+template<typename T>
+void expExact(const T* x, T* out, const size_t n) {
+    for (size_t i = 0; (i < n); i++) {
+        out[i] = std::exp(x[i]);
+    }
+}
+
+template<typename T>
+void sigmoidExact(const T* x, T* out, const size_t n) {
+    for (size_t i = 0; (i < n); i++) {
+        out[i] = 1. / (1. + std::exp(-x[i]));
+    }
+}
+
+template<typename T>
+void tanhExact(const T* x, T* out, const size_t n) {
+    for (size_t i = 0; (i < n); i++) {
+        out[i] = std::tanh(x[i]);
+    }
+}
+
+// -------------------[ Shared bodies for vector kernels ]---------------
+
+template<typename T, size_t W, int Op>
+NN_ALWAYS_INLINE void binaryBody(const T* x, const T* y, T* out,
+                                 const size_t n) {
+    using V = typename Vec<T, W>::type;
+    size_t i = 0;
+    for (; (i + W <= n); i += W) {
+        V vx, vy, res;
+        std::memcpy(&vx, x + i, sizeof(V));
+        std::memcpy(&vy, y + i, sizeof(V));
+        combine<Op>(res, vx, vy);
+        std::memcpy(out + i, &res, sizeof(V));
+    }
+    // Handle the remaining tail one element at a time.
+    for (; (i < n); i++) {
+        combine<Op>(out[i], x[i], y[i]);
+    }
+}
+
+template<typename T, size_t W>
+NN_ALWAYS_INLINE void scaleBody(const T* x, const T alpha, T* out,
+                                const size_t n) {
+    using V = typename Vec<T, W>::type;
+    size_t i = 0;
+    for (; (i + W <= n); i += W) {
+        V vx;
+        std::memcpy(&vx, x + i, sizeof(V));
+        vx *= alpha;
+        std::memcpy(out + i, &vx, sizeof(V));
+    }
+    for (; (i < n); i++) {
+        out[i] = x[i] * alpha;
+    }
+}
+
+template<typename T, size_t W>
+NN_ALWAYS_INLINE void axpyBody(const T alpha, const T* x, T* y,
+                               const size_t n) {
+    using V = typename Vec<T, W>::type;
+    size_t i = 0;
+    for (; (i + W <= n); i += W) {
+        V vx, vy;
+        std::memcpy(&vx, x + i, sizeof(V));
+        std::memcpy(&vy, y + i, sizeof(V));
+        vy += alpha * vx;
+        std::memcpy(y + i, &vy, sizeof(V));
+    }
+    for (; (i < n); i++) {
+        y[i] += alpha * x[i];
+    }
+}
+
+template<typename T, size_t W>
+NN_ALWAYS_INLINE T dotBody(const T* x, const T* y, const size_t n) {
+    using V = typename Vec<T, W>::type;
+    // Four independent accumulators hide the latency of the
+    // multiply-add chain.
+    V acc0 = {}, acc1 = {}, acc2 = {}, acc3 = {};
+    size_t i = 0;
+    for (; (i + 4 * W <= n); i += 4 * W) {
+        V x0, x1, x2, x3, y0, y1, y2, y3;
+        std::memcpy(&x0, x + i, sizeof(V));
+        std::memcpy(&x1, x + i + W, sizeof(V));
+        std::memcpy(&x2, x + i + 2 * W, sizeof(V));
+        std::memcpy(&x3, x + i + 3 * W, sizeof(V));
+        std::memcpy(&y0, y + i, sizeof(V));
+        std::memcpy(&y1, y + i + W, sizeof(V));
+        std::memcpy(&y2, y + i + 2 * W, sizeof(V));
+        std::memcpy(&y3, y + i + 3 * W, sizeof(V));
+        acc0 += x0 * y0;
+        acc1 += x1 * y1;
+        acc2 += x2 * y2;
+        acc3 += x3 * y3;
+    }
+    for (; (i + W <= n); i += W) {
+        V x0, y0;
+        std::memcpy(&x0, x + i, sizeof(V));
+        std::memcpy(&y0, y + i, sizeof(V));
+        acc0 += x0 * y0;
+    }
+    acc0 += acc1 + acc2 + acc3;
+    T sum = 0;
+    for (size_t lane = 0; (lane < W); lane++) {
+        sum += acc0[lane];
+    }
+    for (; (i < n); i++) {
+        sum += x[i] * y[i];
+    }
+    return sum;
+}
+
+// The register tile is held as gemm::MR vectors of gemm::NR values.
+// The compiler splits each vector into as many native registers as
+// the target instruction set requires.
+template<typename T>
+NN_ALWAYS_INLINE void microKernelBody(const size_t kc, const T* a,
+                                      const T* b, T* c, const size_t ldc,
+                                      const size_t mr, const size_t nr,
+                                      const bool accumulate) {
+    using V = typename Vec<T, gemm::NR>::type;
+    V acc[gemm::MR] = {};
+    for (size_t p = 0; (p < kc); p++, a += gemm::MR, b += gemm::NR) {
+        V vb;
+        std::memcpy(&vb, b, sizeof(V));
+        for (size_t i = 0; (i < gemm::MR); i++) {
+            acc[i] += a[i] * vb;
+        }
+    }
+    if ((mr == gemm::MR) && (nr == gemm::NR)) {
+        // Common case: a full tile is written with vector stores.
+        for (size_t i = 0; (i < gemm::MR); i++) {
+            T* row = c + i * ldc;
+            if (accumulate) {
+                V vc;
+                std::memcpy(&vc, row, sizeof(V));
+                acc[i] += vc;
+            }
+            std::memcpy(row, &acc[i], sizeof(V));
+        }
+    } else {
+        // Edge tile: only the valid corner is written.
+        for (size_t i = 0; (i < mr); i++) {
+            T* row = c + i * ldc;
+            for (size_t j = 0; (j < nr); j++) {
+                row[j] = accumulate ? (row[j] + acc[i][j]) : acc[i][j];
+            }
+        }
+    }
+}
+
+// Constants of the floating-point formats used by the exponential.
+template<typename T> struct ExpTraits;
+
+template<>
+struct ExpTraits<float> {
+    using Int = int32_t;
+    // The number of mantissa bits and the exponent bias.
+    static constexpr int Mantissa = 23, Bias = 127;
+    // 1.5 * 2^23.  Adding it to a small value rounds the value to an
+    // integer, which is then held in the low bits of the sum.
+    static constexpr float Round = 12582912.0f;
+    // e^x overflows above MaxLog and is not normal below MinLog.
+    static constexpr float MaxLog = 88.7228391f, MinLog = -87.3365448f;
+    // tanh(x) rounds to 1 above TanhLimit.
+    static constexpr float TanhLimit = 9.5f;
+};
+
+template<>
+struct ExpTraits<double> {
+    using Int = int64_t;
+    static constexpr int Mantissa = 52, Bias = 1023;
+    static constexpr double Round = 6755399441055744.0;
+    static constexpr double MaxLog = 709.782712893384;
+    static constexpr double MinLog = -708.396418532264;
+    static constexpr double TanhLimit = 19.5;
+};
+
+// Returns 1 / n!.
+constexpr double inverseFactorial(const int n) {
+    return (n <= 1) ? 1.0 : inverseFactorial(n - 1) / n;
+}
+
+// Splits e^x into 2^k * (q + 1), where x = k * ln(2) + r with |r| <=
+// ln(2) / 2 and q = e^r - 1.  The power of two is returned as the
+// product of two factors s1 and s2, so that it may exceed the range
+// of the format.  x must be within [MinLog, MaxLog] (or NaN).
+template<typename T, size_t W, int Degree>
+NN_ALWAYS_INLINE void expSplit(const typename Vec<T, W>::type& x,
+                               typename Vec<T, W>::type& q,
+                               typename Vec<T, W>::type& s1,
+                               typename Vec<T, W>::type& s2) {
+    using V = typename Vec<T, W>::type;
+    using Int = typename ExpTraits<T>::Int;
+    using I = typename Vec<Int, W>::type;
+    const T round = ExpTraits<T>::Round, log2e = 1.44269504088896340736;
+    // ln(2) is split into a part with few bits, so that k * ln2Hi is
+    // exact, and the remainder.
+    const T ln2Hi = 0.693359375, ln2Lo = -2.12194440054690582e-4;
+    const V sum = x * log2e + round;
+    const V k = sum - round;
+    const V r = (x - k * ln2Hi) - k * ln2Lo;
+    // The Taylor polynomial r + r^2 / 2! + ... + r^Degree / Degree!.
+    V p = V{} + T(inverseFactorial(Degree));
+    for (int d = Degree - 1; (d >= 2); d--) {
+        p = p * r + T(inverseFactorial(d));
+    }
+    q = r + r * r * p;
+    // Build 2^k1 and 2^k2, with k1 + k2 = k, from their exponent bits.
+    const Int bias = ExpTraits<T>::Bias, shift = ExpTraits<T>::Mantissa;
+    Int roundBits;
+    I ki;
+    std::memcpy(&roundBits, &round, sizeof(T));
+    std::memcpy(&ki, &sum, sizeof(V));
+    ki -= roundBits;
+    const I k1 = ki >> 1;
+    const I e1 = (k1 + bias) << shift, e2 = (ki - k1 + bias) << shift;
+    std::memcpy(&s1, &e1, sizeof(V));
+    std::memcpy(&s2, &e2, sizeof(V));
+}
+
+// Replaces a vector of values by their activations.
+template<typename T, size_t W, int Op, int Degree>
+NN_ALWAYS_INLINE void activate(typename Vec<T, W>::type& x) {
+    using V = typename Vec<T, W>::type;
+    const V zero = {}, one = zero + 1;
+    V q, s1, s2;
+    if (Op == ActTanh) {
+        // tanh(|x|) = (e^2|x| - 1) / (e^2|x| + 1), where e^2|x| - 1 =
+        // 2^k * q + (2^k - 1) has no cancellation for small |x|.
+        const T limit = ExpTraits<T>::TanhLimit;
+        V a = (x < zero) ? -x : x;
+        a = (a > limit) ? zero + limit : a;
+        expSplit<T, W, tanhDegree(Degree)>(a + a, q, s1, s2);
+        const V scale = s1 * s2;
+        const V em = scale * q + (scale - 1);
+        const V t = em / (em + 2);
+        x = (x < zero) ? -t : t;
+        return;
+    }
+    // e^y, with y = -x for the sigmoid 1 / (1 + e^-x).
+    const T maxLog = ExpTraits<T>::MaxLog, minLog = ExpTraits<T>::MinLog;
+    const V y = (Op == ActSigmoid) ? -x : x;
+    V c = (y < minLog) ? zero + minLog : y;
+    c = (c > maxLog) ? zero + maxLog : c;
+    expSplit<T, W, Degree>(c, q, s1, s2);
+    V e = (s1 * (q + 1)) * s2;
+    e = (y < minLog) ? zero : e;
+    e = (y > maxLog) ? zero + std::numeric_limits<T>::infinity() : e;
+    x = (Op == ActSigmoid) ? one / (one + e) : e;
+}
+
+template<typename T, size_t W, int Op, int Degree>
+NN_ALWAYS_INLINE void activationBody(const T* x, T* out, const size_t n) {
+    using V = typename Vec<T, W>::type;
+    size_t i = 0;
+    for (; (i + W <= n); i += W) {
+        V v;
+        std::memcpy(&v, x + i, sizeof(V));
+        activate<T, W, Op, Degree>(v);
+        std::memcpy(out + i, &v, sizeof(V));
+    }
+    if (i < n) {
+        // The tail is padded with zeros to one more vector.
+        V v = {};
+        std::memcpy(&v, x + i, (n - i) * sizeof(T));
+        activate<T, W, Op, Degree>(v);
+        std::memcpy(out + i, &v, (n - i) * sizeof(T));
+    }
+}
+
+// Defines the full set of vector kernels for one instruction set
+// along with a factory that builds the corresponding kernel table.
+#define NN_DEFINE_ISA_KERNELS(SUFFIX, TARGET, BYTES)                    \
+    template<typename T, int Op> TARGET                                 \
+    void binary##SUFFIX(const T* x, const T* y, T* out, size_t n) {     \
+        binaryBody<T, (BYTES) / sizeof(T), Op>(x, y, out, n);           \
+    }                                                                   \
+    template<typename T> TARGET                                         \
+    void scale##SUFFIX(const T* x, T alpha, T* out, size_t n) {         \
+        scaleBody<T, (BYTES) / sizeof(T)>(x, alpha, out, n);            \
+    }                                                                   \
+    template<typename T> TARGET                                         \
+    void axpy##SUFFIX(T alpha, const T* x, T* y, size_t n) {            \
+        axpyBody<T, (BYTES) / sizeof(T)>(alpha, x, y, n);               \
+    }                                                                   \
+    template<typename T> TARGET                                         \
+    T dot##SUFFIX(const T* x, const T* y, size_t n) {                   \
+        return dotBody<T, (BYTES) / sizeof(T)>(x, y, n);                \
+    }                                                                   \
+    template<typename T> TARGET                                         \
+    void microKernel##SUFFIX(size_t kc, const T* a, const T* b, T* c,   \
+                             size_t ldc, size_t mr, size_t nr,          \
+                             bool accumulate) {                         \
+        microKernelBody<T>(kc, a, b, c, ldc, mr, nr, accumulate);       \
+    }                                                                   \
+    template<typename T>                                                \
+    Kernels<T> make##SUFFIX(const Isa isa) {                            \
+        return Kernels<T>{isa, binary##SUFFIX<T, OpAdd>,                \
+                binary##SUFFIX<T, OpSub>, binary##SUFFIX<T, OpMul>,     \
+                scale##SUFFIX<T>, axpy##SUFFIX<T>, dot##SUFFIX<T>,      \
+                microKernel##SUFFIX<T>};                                \
+    }                                                                   \
+    template<typename T, int Op, int Degree> TARGET                     \
+    void activation##SUFFIX(const T* x, T* out, size_t n) {             \
+        activationBody<T, (BYTES) / sizeof(T), Op, Degree>(x, out, n);  \
+    }                                                                   \
+    template<typename T, int Degree>                                    \
+    Activations<T> makeActivations##SUFFIX(const Isa isa,               \
+                                           const Accuracy accuracy) {   \
+        return Activations<T>{isa, accuracy,                            \
+                activation##SUFFIX<T, ActExp, Degree>,                  \
+                activation##SUFFIX<T, ActSigmoid, Degree>,              \
+                activation##SUFFIX<T, ActTanh, Degree>};                \
+    }
+
+#ifdef NN_SIMD_X86
+// SSE2 is part of the x86-64 baseline, so it needs no target attribute.
+NN_DEFINE_ISA_KERNELS(SSE2, , 16)
+NN_DEFINE_ISA_KERNELS(AVX2, __attribute__((target("avx2,fma"))), 32)
+NN_DEFINE_ISA_KERNELS(AVX512, __attribute__((target("avx512f"))), 64)
+#endif
+
+template<typename T>
+Kernels<T> makeScalar() {
+    return Kernels<T>{Isa::Scalar, binaryScalar<T, OpAdd>,
+            binaryScalar<T, OpSub>, binaryScalar<T, OpMul>, scaleScalar<T>,
+            axpyScalar<T>, dotScalar<T>, microKernelScalar<T>};
+}
+
+// The portable variant of the approximate activation functions uses
+// vectors of one value.
+template<typename T, int Op, int Degree>
+void activationScalar(const T* x, T* out, const size_t n) {
+    activationBody<T, 1, Op, Degree>(x, out, n);
+}
+
+// Builds the table of approximate activation functions for the given
+// instruction set.
+template<typename T, int Degree>
+Activations<T> makeActivations(const Isa isa, const Accuracy accuracy) {
+    switch (isa) {
+#ifdef NN_SIMD_X86
+    case Isa::AVX512: return makeActivationsAVX512<T, Degree>(isa, accuracy);
+    case Isa::AVX2:   return makeActivationsAVX2<T, Degree>(isa, accuracy);
+    case Isa::SSE2:   return makeActivationsSSE2<T, Degree>(isa, accuracy);
+#endif
+    default:
+        return Activations<T>{isa, accuracy,
+                activationScalar<T, ActExp, Degree>,
+                activationScalar<T, ActSigmoid, Degree>,
+                activationScalar<T, ActTanh, Degree>};
+    }
+}
+
+// Builds the table of activation functions for an accuracy tier.
+template<typename T>
+Activations<T> makeActivations(const Accuracy accuracy) {
+    switch (accuracy) {
+    case Accuracy::High:
+        return makeActivations<T, HighDegree>(activeIsa(), accuracy);
+    case Accuracy::Fast:
+        return makeActivations<T, FastDegree>(activeIsa(), accuracy);
+    default:
+        return Activations<T>{Isa::Scalar, accuracy, expExact<T>,
+                sigmoidExact<T>, tanhExact<T>};
+    }
+}
+
+// Builds the kernel table for the given instruction set.  Only the
+// built-in floating-point types have vector variants.
+template<typename T>
+Kernels<T> makeKernels(const Isa, std::false_type) {
+    return makeScalar<T>();
+}
+
+template<typename T>
+Kernels<T> makeKernels(const Isa isa, std::true_type) {
+    switch (isa) {
+#ifdef NN_SIMD_X86
+    case Isa::AVX512: return makeAVX512<T>(isa);
+    case Isa::AVX2:   return makeAVX2<T>(isa);
+    case Isa::SSE2:   return makeSSE2<T>(isa);
+#endif
+    default:          return makeScalar<T>();
+    }
+}
+
+// Returns the best instruction set supported by this host.
+Isa hostIsa() {
+#ifdef NN_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return Isa::AVX512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return Isa::AVX2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return Isa::SSE2;
+    }
+#endif
+    return Isa::Scalar;
+}
+
+}  // namespace
+
+const char* isaName(const Isa isa) {
+    switch (isa) {
+    case Isa::SSE2:   return "sse2";
+    case Isa::AVX2:   return "avx2";
+    case Isa::AVX512: return "avx512";
+    default:          return "scalar";
+    }
+}
+
+Isa activeIsa() {
+    static const Isa isa = [] {
+        const Isa best = hostIsa();
+        // Honor an override only if the host can actually run it.
+        const char* env = std::getenv("NN_SIMD");
+        if (env != nullptr) {
+            for (int i = 0; (i <= static_cast<int>(best)); i++) {
+                if (isaName(static_cast<Isa>(i)) == std::string(env)) {
+                    return static_cast<Isa>(i);
+                }
+            }
+        }
+        return best;
+    }();
+    return isa;
+}
+
+template<typename T>
+const Kernels<T>& kernels() {
+    static const Kernels<T> table =
+        makeKernels<T>(activeIsa(), std::is_floating_point<T>());
+    return table;
+}
+
+template<typename T>
+const Activations<T>& activations(const Accuracy accuracy) {
+    static const Activations<T> tables[] = {
+        makeActivations<T>(Accuracy::Exact),
+        makeActivations<T>(Accuracy::High),
+        makeActivations<T>(Accuracy::Fast)};
+    return tables[static_cast<int>(accuracy)];
+}
+
+// Explicit instantiations for the supported element types.
+template const Kernels<float>& kernels<float>();
+template const Kernels<double>& kernels<double>();
+template const Kernels<BFloat16>& kernels<BFloat16>();
+template const Kernels<Float16>& kernels<Float16>();
+template const Activations<float>& activations<float>(Accuracy);
+template const Activations<double>& activations<double>(Accuracy);
+
+}  // namespace simd
+
+#endif
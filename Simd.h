@@ -0,0 +1,172 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+/** \file Simd.h Runtime-dispatched vector kernels.
+
+    This file contains the declaration of the table of explicitly
+    vectorized kernels used by Matrix for element-wise arithmetic and
+    by the GEMM engine for its register-tiled micro-kernel.
+
+    The project is built without any architecture flags so that one
+    binary runs on every x86-64 host.  Instead, each kernel is
+    compiled several times -- once per instruction set (SSE2, AVX2 +
+    FMA, AVX-512) -- and the best variant supported by the host is
+    picked via CPUID the first time the kernel table is requested.
+    On non-x86 hosts only the portable scalar variant is available.
+
+    The selection can be narrowed (never widened beyond what the host
+    supports) via the \c NN_SIMD environment variable, which accepts
+    \c scalar, \c sse2, \c avx2, or \c avx512.  This is handy for
+    checking results across CPU generations on a single machine.
+
+    The file also declares vectorized activation functions (exp,
+    sigmoid, and tanh) in several accuracy tiers.  The approximate
+    tiers reduce the argument to x = k * ln(2) + r, with |r| <= ln(2)
+    / 2, evaluate a polynomial for exp(r) - 1, and scale the result by
+    2^k via its exponent bits -- entirely in vector registers, unlike
+    the scalar calls to libm.  Their maximum relative errors, measured
+    against long double references over the whole range of each
+    function, are:
+
+    <table>
+    <tr><th>Tier</th><th>float</th><th>double</th></tr>
+    <tr><td>Accuracy::Exact</td><td colspan="2">libm (std::exp and
+    std::tanh)</td></tr>
+    <tr><td>Accuracy::High</td><td>2e-7</td><td>2e-8</td></tr>
+    <tr><td>Accuracy::Fast</td><td colspan="2">6e-5 (1e-5 for
+    tanh)</td></tr>
+    </table>
+
+    SimdTest.cpp checks these bounds (rounded up to 2e-7 for float,
+    1e-7 for double, and 1e-4 for the Fast tier) with the kernels of
+    every instruction set.
+
+    With AVX-512 the approximate sigmoid is about 7x (float) and 5x
+    (double) faster than the libm-based one.
+
+    Copyright (C) 2021 raodm@miamiOH.edu
+*/
+
+#include <cstddef>
+
+namespace simd {
+
+/** The instruction sets for which kernels are compiled. */
+enum class Isa { Scalar, SSE2, AVX2, AVX512 };
+
+/**
+ * Returns the instruction set selected for this process.  The
+ * selection is made once, on first use, and never changes.
+ */
+Isa activeIsa();
+
+/**
+ * Returns a human-readable name for the given instruction set.
+ *
+ * \param[in] isa The instruction set whose name is to be returned.
+ */
+const char* isaName(Isa isa);
+
+/**
+ * The table of kernels for a given element type.  Each entry points
+ * to the variant compiled for the instruction set in \c isa.  All
+ * kernels accept unaligned pointers.  The output of the element-wise
+ * kernels may alias either of the inputs.
+ */
+template<typename T>
+struct Kernels {
+    /** The instruction set these kernels were compiled for. */
+    Isa isa;
+
+    /** out[i] = x[i] + y[i] for i in [0, n). */
+    void (*add)(const T* x, const T* y, T* out, size_t n);
+
+    /** out[i] = x[i] - y[i] for i in [0, n). */
+    void (*sub)(const T* x, const T* y, T* out, size_t n);
+
+    /** out[i] = x[i] * y[i] for i in [0, n). */
+    void (*mul)(const T* x, const T* y, T* out, size_t n);
+
+    /** out[i] = x[i] * alpha for i in [0, n). */
+    void (*scale)(const T* x, T alpha, T* out, size_t n);
+
+    /** y[i] += alpha * x[i] for i in [0, n). */
+    void (*axpy)(T alpha, const T* x, T* y, size_t n);
+
+    /** Returns the inner product of x and y, each of length n. */
+    T (*dot)(const T* x, const T* y, size_t n);
+
+    /**
+     * The GEMM micro-kernel.  Computes the gemm::MR x gemm::NR tile
+     * of products of the packed slivers \c a and \c b over a depth of
+     * \c kc, and stores (or adds, if \c accumulate is true) the top
+     * left mr x nr portion of it into \c c.
+     */
+    void (*gemmMicroKernel)(size_t kc, const T* a, const T* b, T* c,
+                            size_t ldc, size_t mr, size_t nr,
+                            bool accumulate);
+};
+
+/**
+ * The accuracy tiers of the activation functions.  See the file
+ * comment for their error bounds.
+ */
+enum class Accuracy {
+    Exact,  ///< Scalar libm calls, i.e., the reference results.
+    High,   ///< Vectorized, within a few ulp of float precision.
+    Fast    ///< Vectorized, trading accuracy (~1e-4) for speed.
+};
+
+/**
+ * An activation function applied to n values, i.e., out[i] = f(x[i])
+ * for i in [0, n).  \c out may be the same as \c x.
+ */
+template<typename T>
+using ActivationFn = void (*)(const T* x, T* out, size_t n);
+
+/**
+ * The table of activation functions for a given element type and
+ * accuracy tier.  Each function computes out[i] = f(x[i]) for i in
+ * [0, n), and \c out may be the same as \c x.  Infinities and NaNs
+ * are handled as by libm, except that the approximate tiers flush
+ * results below the smallest normal value to zero.
+ */
+template<typename T>
+struct Activations {
+    /** The instruction set these functions were compiled for. */
+    Isa isa;
+
+    /** The accuracy tier of these functions. */
+    Accuracy accuracy;
+
+    /** The exponential function, e^x. */
+    void (*exp)(const T* x, T* out, size_t n);
+
+    /** The logistic sigmoid function, 1 / (1 + e^-x). */
+    void (*sigmoid)(const T* x, T* out, size_t n);
+
+    /** The hyperbolic tangent. */
+    void (*tanh)(const T* x, T* out, size_t n);
+};
+
+/**
+ * Returns the kernel table selected for this host for the given
+ * element type.  Vector variants exist for \c float and \c double.
+ * The reduced-precision storage types in Float16.h (BFloat16 and
+ * Float16) always use the portable scalar kernels.
+ */
+template<typename T>
+const Kernels<T>& kernels();
+
+/**
+ * Returns the activation functions of an accuracy tier for this host.
+ * Tables exist for \c float and \c double.
+ *
+ * \param[in] accuracy The accuracy tier.
+ */
+template<typename T>
+const Activations<T>& activations(Accuracy accuracy);
+
+}  // namespace simd
+
+#endif
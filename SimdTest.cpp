@@ -0,0 +1,149 @@
+/**
+ * A test that checks the accuracy tiers of the vectorized activation
+ * functions in Simd.h against libm.  The functions of the instruction
+ * set selected via the NN_SIMD environment variable are swept over
+ * the whole range of each function in float and double, and the
+ * maximum relative errors are compared against the bounds documented
+ * in Simd.h.  CMakeLists.txt runs this test once per instruction set.
+ * If the host does not support the requested instruction set, the
+ * test exits with SkipCode instead of testing a different one.
+ *
+ * Copyright (C) 2021 raodm@miamiOH.edu
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+#include <vector>
+#include "Simd.h"
+
+/** The exit code that CTest reports as a skipped test. */
+constexpr int SkipCode = 77;
+
+/**
+ * The maximum relative error allowed for a tier.  A float result is
+ * already off by up to 6e-8 just from rounding, so the High tier is
+ * allowed two units in the last place in float.
+ *
+ * \param[in] accuracy The accuracy tier being checked.
+ *
+ * \return The bound on the relative error of the tier.
+ */
+template<typename T>
+double errorBound(const simd::Accuracy accuracy) {
+    if (accuracy == simd::Accuracy::Fast) {
+        return 1e-4;
+    }
+    return std::is_same<T, float>::value ? 2e-7 : 1e-7;
+}
+
+/**
+ * Returns the maximum relative error of a vectorized function over a
+ * set of arguments.  Arguments whose exact results are not normal
+ * values of T (underflow or overflow) are skipped since the functions
+ * flush or saturate them by design.
+ *
+ * \param[in] fn The vectorized function to be checked.
+ *
+ * \param[in] ref The reference function, evaluated in long double.
+ *
+ * \param[in] x The arguments.
+ */
+template<typename T, typename Ref>
+double maxError(simd::ActivationFn<T> fn, const Ref& ref,
+                const std::vector<T>& x) {
+    std::vector<T> y(x.size());
+    fn(x.data(), y.data(), x.size());
+    double maxErr = 0;
+    for (size_t i = 0; (i < x.size()); i++) {
+        const long double exact = ref(static_cast<long double>(x[i]));
+        if ((std::fabs(exact) < std::numeric_limits<T>::min()) ||
+            (std::fabs(exact) > std::numeric_limits<T>::max())) {
+            continue;
+        }
+        const double err = std::fabs((y[i] - exact) / exact);
+        maxErr = std::max(maxErr, err);
+    }
+    return maxErr;
+}
+
+/**
+ * Returns count arguments evenly spaced in [lo, hi].  Their count is
+ * odd and not a multiple of the vector widths, so the tails of the
+ * kernels are checked as well.
+ */
+template<typename T>
+std::vector<T> linspace(const double lo, const double hi,
+                        const size_t count = 200001) {
+    std::vector<T> x(count);
+    for (size_t i = 0; (i < count); i++) {
+        x[i] = T(lo + (hi - lo) * i / (count - 1));
+    }
+    return x;
+}
+
+/**
+ * Checks one accuracy tier of the activation functions for T.
+ *
+ * \param[in] name The name of T for the report.
+ *
+ * \param[in] accuracy The accuracy tier to be checked.
+ *
+ * \param[in] maxLog The largest argument of exp whose result is
+ * finite in T.
+ *
+ * \return The number of functions that exceeded the bound.
+ */
+template<typename T>
+int check(const char* name, const simd::Accuracy accuracy,
+          const double maxLog) {
+    const simd::Activations<T>& fns = simd::activations<T>(accuracy);
+    const std::vector<T> wide = linspace<T>(-maxLog, maxLog);
+    // Small arguments check tanh(x) ~ x, where an approximation that
+    // cancels would lose all its relative accuracy.
+    std::vector<T> small = linspace<T>(-30, 1, 20001);
+    for (T& v : small) {
+        v = T(std::pow(10.0L, v));
+    }
+
+    const double expErr = maxError<T>(fns.exp, [](long double v) {
+        return std::exp(v); }, wide);
+    const double sigmoidErr = maxError<T>(fns.sigmoid, [](long double v) {
+        return 1 / (1 + std::exp(-v)); }, wide);
+    const auto tanhRef = [](long double v) { return std::tanh(v); };
+    const double tanhErr = std::max(maxError<T>(fns.tanh, tanhRef, wide),
+                                    maxError<T>(fns.tanh, tanhRef, small));
+
+    const double bound = errorBound<T>(accuracy);
+    const char* tier = (accuracy == simd::Accuracy::High) ? "high" : "fast";
+    std::printf("%-6s %-4s %-6s exp %.3g, sigmoid %.3g, tanh %.3g "
+                "(bound %.0e)\n", name, tier, simd::isaName(fns.isa),
+                expErr, sigmoidErr, tanhErr, bound);
+    return (expErr > bound) + (sigmoidErr > bound) + (tanhErr > bound);
+}
+
+int main() {
+    const char* const requested = std::getenv("NN_SIMD");
+    const char* const isa = simd::isaName(simd::activeIsa());
+    std::printf("Testing the %s kernels\n", isa);
+    if ((requested != nullptr) && (std::strcmp(requested, isa) != 0)) {
+        std::printf("The host does not support %s; skipping\n",
+                    requested);
+        return SkipCode;
+    }
+    int failures = 0;
+    for (const auto accuracy : {simd::Accuracy::High,
+                                simd::Accuracy::Fast}) {
+        failures += check<float>("float", accuracy, 88);
+        failures += check<double>("double", accuracy, 709);
+    }
+    if (failures > 0) {
+        std::printf("%d function(s) exceeded their error bounds\n",
+                    failures);
+    }
+    return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,119 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+/** \file SpscQueue.h A lock-free single-producer, single-consumer queue.
+
+    This file contains a bounded FIFO queue for passing values from
+    exactly one producer thread to exactly one consumer thread without
+    locks.  The values live in a fixed ring of slots.  The producer
+    only writes the tail index and the consumer only writes the head
+    index, with release stores and acquire loads ordering the slot
+    accesses, so each operation is a handful of instructions.  The
+    two indices are kept on separate cache lines so that the producer
+    and the consumer do not invalidate each other's line on every
+    operation.
+
+    Copyright (C) 2021 raodm@miamiOH.edu
+*/
+
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "AlignedBuffer.h"
+
+/**
+ * A bounded lock-free queue with one producer and one consumer thread.
+ * See the file comment for details.
+ *
+ * \tparam T The type of values in the queue.  It must be default
+ * constructible and movable.
+ */
+template<typename T>
+class SpscQueue {
+public:
+    /**
+     * Creates an empty queue.
+     *
+     * \param[in] capacity The maximum number of values in the queue.
+     */
+    explicit SpscQueue(const size_t capacity) : slots(capacity + 1) {}
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    /**
+     * Adds a value to the end of the queue, unless it is full.  Only
+     * the producer thread may call this method.
+     *
+     * \param[in,out] value The value to add.  It is moved from only if
+     * it is added.
+     *
+     * \return True if the value was added.
+     */
+    bool tryPush(T& value) {
+        const size_t pos = tail.load(std::memory_order_relaxed);
+        const size_t next = (pos + 1 == slots.size()) ? 0 : (pos + 1);
+        if (next == head.load(std::memory_order_acquire)) {
+            return false;  // Full.
+        }
+        slots[pos] = std::move(value);
+        tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Removes the value at the front of the queue, unless it is
+     * empty.  Only the consumer thread may call this method.
+     *
+     * \param[out] value The value removed from the queue.
+     *
+     * \return True if a value was removed.
+     */
+    bool tryPop(T& value) {
+        const size_t pos = head.load(std::memory_order_relaxed);
+        if (pos == tail.load(std::memory_order_acquire)) {
+            return false;  // Empty.
+        }
+        value = std::move(slots[pos]);
+        head.store((pos + 1 == slots.size()) ? 0 : (pos + 1),
+                   std::memory_order_release);
+        return true;
+    }
+
+    /** Adds a value, yielding the thread while the queue is full. */
+    void push(T value) {
+        while (!tryPush(value)) {
+            std::this_thread::yield();
+        }
+    }
+
+    /** Removes a value, yielding the thread while the queue is empty. */
+    T pop() {
+        T value;
+        while (!tryPop(value)) {
+            std::this_thread::yield();
+        }
+        return value;
+    }
+
+private:
+    /** The ring of slots.  One slot is always empty, to tell a full
+        queue from an empty one. */
+    std::vector<T> slots;
+
+    /** Padding to keep the indices off the cache line of slots. */
+    char pad0[memory::Alignment];
+
+    /** The index of the next value to be removed by the consumer. */
+    std::atomic<size_t> head{0};
+
+    /** Padding to keep the indices on separate cache lines. */
+    char pad1[memory::Alignment - sizeof(std::atomic<size_t>)];
+
+    /** The index of the next slot to be filled by the producer. */
+    std::atomic<size_t> tail{0};
+};
+
+#endif
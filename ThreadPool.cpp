@@ -0,0 +1,185 @@
+// Copyright (C) 2021 raodm@miamioh.edu
+
+#ifndef THREAD_POOL_CPP
+#define THREAD_POOL_CPP
+
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+#include "ThreadPool.h"
+#include "Numa.h"
+
+namespace {
+
+// The pool (if any) whose worker is the current thread, along with
+// the index of the worker's own deque.
+thread_local const ThreadPool* currentPool = nullptr;
+thread_local size_t currentIndex = 0;
+
+// Returns the concurrency of the global pool from NN_NUM_THREADS or
+// from the number of hardware threads.
+size_t defaultConcurrency() {
+    const char* env = std::getenv("NN_NUM_THREADS");
+    if (env != nullptr) {
+        const long threads = std::strtol(env, nullptr, 10);
+        if (threads > 0) {
+            return threads;
+        }
+    }
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+}  // namespace
+
+ThreadPool::ThreadPool(const size_t concurrency, const bool pinned) {
+    const size_t threads = std::max<size_t>(concurrency, 1) - 1;
+    // One deque per worker plus the shared queue at the end.
+    for (size_t i = 0; (i <= threads); i++) {
+        queues.emplace_back(new Queue());
+    }
+    for (size_t i = 0; (i < threads); i++) {
+        workers.emplace_back(&ThreadPool::workerLoop, this, i, pinned);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    stopping = true;
+    wakeAll();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+ThreadPool&
+ThreadPool::global() {
+    static ThreadPool pool(defaultConcurrency(), numa::enabled());
+    return pool;
+}
+
+size_t
+ThreadPool::ownQueue() const {
+    return (currentPool == this) ? currentIndex : (queues.size() - 1);
+}
+
+void
+ThreadPool::push(Task task) {
+    Queue& queue = *queues[ownQueue()];
+    {
+        // Count the task while holding the lock, since pop() takes it
+        // (and decrements pending) under the same lock.  Otherwise a
+        // thief could run pending-- first and wrap it around.
+        std::lock_guard<std::mutex> guard(queue.lock);
+        queue.tasks.push_back(std::move(task));
+        pending++;
+    }
+    // Take the sleep lock so that a thread about to sleep cannot miss
+    // this notification.
+    { std::lock_guard<std::mutex> guard(sleepLock); }
+    wake.notify_one();
+}
+
+bool
+ThreadPool::pop(Task& task) {
+    if (pending == 0) {
+        return false;  // Fast path: nothing to do anywhere.
+    }
+    const size_t own = ownQueue(), count = queues.size();
+    // First try the back of our own deque, then steal from the front
+    // of the other deques, starting with our neighbor.
+    for (size_t i = 0; (i < count); i++) {
+        Queue& queue = *queues[(own + i) % count];
+        std::lock_guard<std::mutex> guard(queue.lock);
+        if (!queue.tasks.empty()) {
+            if (i == 0) {
+                task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+            } else {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+            }
+            pending--;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool
+ThreadPool::runOne() {
+    Task task;
+    if (!pop(task)) {
+        return false;
+    }
+    task();
+    return true;
+}
+
+void
+ThreadPool::sleep(const std::function<bool()>& done) {
+    std::unique_lock<std::mutex> guard(sleepLock);
+    wake.wait(guard, [&] { return (pending > 0) || stopping || done(); });
+}
+
+void
+ThreadPool::wakeAll() {
+    { std::lock_guard<std::mutex> guard(sleepLock); }
+    wake.notify_all();
+}
+
+void
+ThreadPool::workerLoop(const size_t index, const bool pinned) {
+    if (pinned) {
+        numa::pinToCpu(numa::cpuForThread(index + 1));
+    }
+    currentPool  = this;
+    currentIndex = index;
+    while (!stopping) {
+        if (!runOne()) {
+            sleep([] { return false; });
+        }
+    }
+}
+
+void
+TaskGroup::run(ThreadPool::Task task) {
+    outstanding++;
+    // The pool is captured directly because this group may be
+    // destroyed as soon as its last task decrements outstanding.
+    ThreadPool* const tp = &pool;
+    pool.push([this, tp, task = std::move(task)] {
+        try {
+            task();
+        } catch (...) {
+            std::lock_guard<std::mutex> guard(errorLock);
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+        if (--outstanding == 0) {
+            tp->wakeAll();
+        }
+    });
+}
+
+void
+TaskGroup::waitQuietly() {
+    // Help run queued tasks (ours or others') until our tasks are
+    // done, sleeping only when there is nothing left to run.
+    while (outstanding > 0) {
+        if (!pool.runOne()) {
+            pool.sleep([this] { return outstanding == 0; });
+        }
+    }
+}
+
+void
+TaskGroup::wait() {
+    waitQuietly();
+    if (error) {
+        std::exception_ptr first;
+        std::swap(first, error);
+        std::rethrow_exception(first);
+    }
+}
+
+#endif
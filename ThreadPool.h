@@ -0,0 +1,241 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+/** \file ThreadPool.h A shared work-stealing thread pool.
+
+    This file contains the declaration of the thread pool used to
+    parallelize matrix operations (and anything else that needs to
+    fan out work) without creating threads on every call.
+
+    Each worker thread owns a deque of tasks.  A worker pushes the
+    tasks it spawns onto the back of its own deque and pops from the
+    back (so recently spawned, cache-warm work runs first), while idle
+    workers steal from the front of other workers' deques.  Tasks
+    submitted from threads outside the pool go to a shared queue that
+    all workers steal from.
+
+    Tasks are run as part of a TaskGroup.  A thread that waits on a
+    group keeps running queued tasks until the group is done, so the
+    waiting thread contributes to the work and nested parallel loops
+    (a parallel loop inside a task) cannot deadlock.
+
+    The process-wide pool returned by ThreadPool::global() has
+    concurrency() equal to std::thread::hardware_concurrency(), which
+    can be overridden via the \c NN_NUM_THREADS environment variable.
+    Because the waiting thread also runs tasks, the pool starts one
+    worker thread fewer than its concurrency; with a concurrency of 1
+    all tasks simply run on the calling thread.  In the NUMA-aware
+    mode (see Numa.h) the workers of the global pool are pinned to
+    cores spread over the NUMA nodes.
+
+    Copyright (C) 2021 raodm@miamiOH.edu
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class TaskGroup;
+
+/**
+ * A pool of worker threads that run tasks with work stealing.  See
+ * the file comment for details.
+ */
+class ThreadPool {
+    friend class TaskGroup;
+
+public:
+    /** The type of tasks run by the pool. */
+    using Task = std::function<void()>;
+
+    /**
+     * Creates a pool that runs up to \c concurrency tasks at a time,
+     * i.e., with concurrency - 1 worker threads plus the thread that
+     * waits for the tasks.
+     *
+     * \param[in] concurrency The number of tasks to run concurrently.
+     * Values less than 1 are treated as 1.
+     *
+     * \param[in] pinned If true, worker i is pinned to the core
+     * numa::cpuForThread(i + 1), leaving the first core for the
+     * thread that waits for the tasks.
+     */
+    explicit ThreadPool(size_t concurrency, bool pinned = false);
+
+    /** Stops and joins the worker threads.  All task groups must have
+        been waited for before the pool is destroyed. */
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /**
+     * Returns the process-wide pool, creating it on first use.  Its
+     * size is taken from the \c NN_NUM_THREADS environment variable
+     * if set, and from std::thread::hardware_concurrency() otherwise.
+     * Its workers are pinned if numa::enabled().
+     */
+    static ThreadPool& global();
+
+    /** Returns the number of tasks this pool runs concurrently. */
+    size_t concurrency() const { return workers.size() + 1; }
+
+private:
+    /** A deque of tasks together with the lock protecting it. */
+    struct Queue {
+        std::mutex lock;
+        std::deque<Task> tasks;
+    };
+
+    /**
+     * Queues a task.  Tasks spawned by a worker of this pool go to the
+     * back of its own deque; all others go to the shared queue.
+     */
+    void push(Task task);
+
+    /**
+     * Runs one queued task, if there is one, on the calling thread.
+     *
+     * \return True if a task was run.
+     */
+    bool runOne();
+
+    /** Removes the next task for the calling thread from the queues.
+        Returns false if all queues are empty. */
+    bool pop(Task& task);
+
+    /**
+     * Blocks the calling thread until a task is queued, the pool is
+     * stopped, or \c done returns true.
+     */
+    void sleep(const std::function<bool()>& done);
+
+    /** Wakes up all sleeping threads (e.g., when a group finishes). */
+    void wakeAll();
+
+    /** The main loop of worker thread \c index, which is first
+        pinned to a core if \c pinned is true. */
+    void workerLoop(size_t index, bool pinned);
+
+    /** The index of the calling thread's deque if it is a worker of
+        this pool, or queues.size() - 1 (the shared queue) otherwise. */
+    size_t ownQueue() const;
+
+    /** One deque per worker followed by the shared queue. */
+    std::vector<std::unique_ptr<Queue>> queues;
+
+    /** The worker threads. */
+    std::vector<std::thread> workers;
+
+    /** The number of queued (not yet started) tasks. */
+    std::atomic<size_t> pending{0};
+
+    /** Flag set when the pool is being destroyed. */
+    std::atomic<bool> stopping{false};
+
+    /** Lock and condition used by idle threads to sleep. */
+    std::mutex sleepLock;
+    std::condition_variable wake;
+};
+
+/**
+ * A set of tasks run on a ThreadPool that can be waited for as a
+ * whole.  The group must be waited for before it is destroyed.
+ *
+ * \code
+ * TaskGroup group;
+ * for (auto& chunk : chunks) {
+ *     group.run([&chunk] { process(chunk); });
+ * }
+ * group.wait();
+ * \endcode
+ */
+class TaskGroup {
+public:
+    /**
+     * Creates an empty group whose tasks run on the given pool.
+     *
+     * \param[in] pool The pool to run tasks on.
+     */
+    explicit TaskGroup(ThreadPool& pool = ThreadPool::global()) :
+        pool(pool) {}
+
+    /** Waits for any tasks that are still running. */
+    ~TaskGroup() { waitQuietly(); }
+
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    /**
+     * Queues a task to be run by the pool as part of this group.
+     *
+     * \param[in] task The task to run.  It must remain valid (along
+     * with anything it refers to) until wait() returns.
+     */
+    void run(ThreadPool::Task task);
+
+    /**
+     * Runs queued tasks on the calling thread until all the tasks in
+     * this group have finished.  If any task threw an exception, the
+     * first such exception is rethrown here.
+     */
+    void wait();
+
+private:
+    /** Waits like wait(), but discards any exception. */
+    void waitQuietly();
+
+    /** The pool on which tasks are run. */
+    ThreadPool& pool;
+
+    /** The number of tasks of this group that have not finished. */
+    std::atomic<size_t> outstanding{0};
+
+    /** The first exception thrown by a task (if any). */
+    std::exception_ptr error;
+
+    /** Lock protecting error. */
+    std::mutex errorLock;
+};
+
+/**
+ * Calls body(begin, end) for consecutive chunks of at most \c
+ * chunkSize iterations that together cover [0, loopSize).  The chunks
+ * run as tasks on the global pool, with the first chunk run by the
+ * calling thread.  If there is only one chunk, or the pool has a
+ * concurrency of 1, \c body is simply called once for the whole
+ * range.
+ *
+ * \param[in] loopSize The number of iterations.
+ *
+ * \param[in] chunkSize The maximum number of iterations per chunk.
+ *
+ * \param[in] body The callable run for each chunk.  It may be called
+ * concurrently for different chunks.
+ */
+template<typename Body>
+void parallelChunks(const size_t loopSize, const size_t chunkSize,
+                    const Body& body) {
+    ThreadPool& pool = ThreadPool::global();
+    if ((loopSize <= chunkSize) || (pool.concurrency() == 1)) {
+        body(0, loopSize);
+        return;
+    }
+    TaskGroup group(pool);
+    for (size_t begin = chunkSize; (begin < loopSize); begin += chunkSize) {
+        const size_t end = std::min(begin + chunkSize, loopSize);
+        group.run([&body, begin, end] { body(begin, end); });
+    }
+    body(0, chunkSize);
+    group.wait();
+}
+
+#endif
@@ -0,0 +1,138 @@
+// Copyright (C) 2021 raodm@miamioh.edu
+
+#ifndef WEIGHT_SNAPSHOTS_CPP
+#define WEIGHT_SNAPSHOTS_CPP
+
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include "WeightSnapshots.h"
+#include "ThreadPool.h"
+
+template<typename T, typename W>
+BasicWeightSnapshots<T, W>::BasicWeightSnapshots(const Net& net,
+                                                 const size_t interval,
+                                                 size_t maxReaders) :
+    current(new Snapshot{net, 0}), interval(std::max<size_t>(interval, 1)) {
+    if (maxReaders == 0) {
+        maxReaders = 2 * ThreadPool::global().concurrency();
+    }
+    slotCount = maxReaders;
+    slots.reset(new Slot[slotCount]);
+    // A retired snapshot is only kept while a reader holds it, so
+    // there are never more than slotCount of them.
+    held.reserve(slotCount);
+    retired.reserve(slotCount + 1);
+}
+
+template<typename T, typename W>
+BasicWeightSnapshots<T, W>::~BasicWeightSnapshots() {
+    delete current.load();
+    for (Snapshot* snapshot : retired) {
+        delete snapshot;
+    }
+}
+
+template<typename T, typename W>
+typename BasicWeightSnapshots<T, W>::Reader
+BasicWeightSnapshots<T, W>::acquire() const {
+    // Claim a free slot, starting at a position that depends on the
+    // thread so that threads rarely compete for the same slot.
+    const size_t start = std::hash<std::thread::id>()(
+        std::this_thread::get_id()) % slotCount;
+    Slot* slot = nullptr;
+    for (size_t i = start; (slot == nullptr); i = (i + 1) % slotCount) {
+        bool expected = false;
+        if (!slots[i].busy.load(std::memory_order_relaxed) &&
+            slots[i].busy.compare_exchange_strong(expected, true,
+                                                  std::memory_order_acquire)) {
+            slot = &slots[i];
+        } else if ((i + 1) % slotCount == start) {
+            std::this_thread::yield();  // All slots are in use.
+        }
+    }
+    // Announce the current snapshot, then check that it is still
+    // current.  If so, publish() will see the announcement before it
+    // can reclaim the snapshot (both sides use sequentially consistent
+    // operations), so the snapshot is safe to use.
+    const Snapshot* snapshot = current.load();
+    while (true) {
+        slot->hazard.store(snapshot);
+        const Snapshot* now = current.load();
+        if (now == snapshot) {
+            break;
+        }
+        snapshot = now;
+    }
+    return Reader(slot, snapshot);
+}
+
+template<typename T, typename W>
+uint64_t
+BasicWeightSnapshots<T, W>::publish(const Net& net) {
+    std::lock_guard<std::mutex> guard(publishLock);
+    // Copy into the spare snapshot if there is one; the assignment
+    // reuses its matrices since they have the same dimensions.
+    std::unique_ptr<Snapshot> next = std::move(spare);
+    if (next) {
+        next->net = net;
+    } else {
+        next.reset(new Snapshot{net, 0});
+    }
+    const uint64_t version = latest + 1;
+    next->version = version;
+    retired.push_back(current.exchange(next.release()));
+    latest = version;
+    pending = 0;
+    reclaim();
+    return version;
+}
+
+template<typename T, typename W>
+bool
+BasicWeightSnapshots<T, W>::trained(const Net& net, const size_t samples) {
+    {
+        std::lock_guard<std::mutex> guard(publishLock);
+        pending += samples;
+        if (pending < interval) {
+            return false;
+        }
+    }
+    publish(net);
+    return true;
+}
+
+template<typename T, typename W>
+void
+BasicWeightSnapshots<T, W>::reclaim() {
+    // Collect the snapshots announced by readers.  A reader that
+    // announces a retired snapshot after this scan will find that it
+    // is no longer current and move on to the current one.
+    held.clear();
+    for (size_t i = 0; (i < slotCount); i++) {
+        const Snapshot* snapshot = slots[i].hazard.load();
+        if (snapshot != nullptr) {
+            held.push_back(snapshot);
+        }
+    }
+    auto unused = std::partition(retired.begin(), retired.end(),
+                                 [this](const Snapshot* snapshot) {
+        return std::find(held.begin(), held.end(), snapshot) != held.end();
+    });
+    for (auto it = unused; (it != retired.end()); it++) {
+        if (!spare) {
+            spare.reset(*it);
+        } else {
+            delete *it;
+        }
+    }
+    retired.erase(unused, retired.end());
+}
+
+// Explicit instantiations for the supported neural networks.
+template class BasicWeightSnapshots<double>;
+template class BasicWeightSnapshots<float>;
+template class BasicWeightSnapshots<float, BFloat16>;
+template class BasicWeightSnapshots<float, Float16>;
+
+#endif
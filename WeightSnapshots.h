@@ -0,0 +1,235 @@
+#ifndef WEIGHT_SNAPSHOTS_H
+#define WEIGHT_SNAPSHOTS_H
+
+/** \file WeightSnapshots.h Concurrent inference during training.
+
+    This file contains a read-copy-update (RCU) style mechanism for
+    classifying inputs with a network while it is being trained in
+    the same process.  BasicNeuralNet::learn changes the weights and
+    biases in place, so a classify() running at the same time would see
+    a mix of old and new values.  Instead, the training thread
+    periodically publishes an immutable copy (snapshot) of the
+    network, and readers classify with the latest snapshot:
+
+    <ul>
+    <li>Publishing copies the network into a snapshot and then makes
+    it current with one atomic pointer exchange.</li>
+
+    <li>A reader acquires the current snapshot without locks: it
+    announces the snapshot it is about to use in a slot of its own
+    (a "hazard pointer") and checks that the snapshot is still
+    current.  Readers never wait for training, and training never
+    waits for readers, so inference latency does not depend on what
+    the training thread is doing.</li>
+
+    <li>A replaced snapshot is reclaimed once no slot holds it.  The
+    training thread checks this whenever it publishes, and reuses the
+    storage of one reclaimed snapshot for the next copy, so a steady
+    state allocates no memory.</li>
+    </ul>
+
+    Copyright (C) 2021 raodm@miamiOH.edu
+*/
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "NeuralNet.h"
+#include "AlignedBuffer.h"
+
+/**
+ * Versioned snapshots of a neural network that is being trained,
+ * for lock-free concurrent inference.  See the file comment for
+ * details.
+ *
+ * \code
+ * WeightSnapshots snapshots(net, 500);
+ * // Training thread:
+ * for (size_t i = 0; (i < data.size()); i++) {
+ *     net.learn(data.input(i), data.expected(i));
+ *     snapshots.trained(net);
+ * }
+ * // Any number of inference threads:
+ * const auto snapshot = snapshots.acquire();
+ * const Matrix out = snapshot->classify(input);
+ * \endcode
+ *
+ * \tparam T The compute type of the network.
+ *
+ * \tparam W The weight storage type of the network.
+ */
+template<typename T, typename W = T>
+class BasicWeightSnapshots {
+    /** A published copy of the network. */
+    struct Snapshot {
+        BasicNeuralNet<T, W> net;
+        uint64_t version;
+    };
+
+    /** The slot in which a reader announces the snapshot it uses.
+        Each slot fills a cache line, so readers do not slow each
+        other down. */
+    struct Slot {
+        std::atomic<bool> busy{false};
+        std::atomic<const Snapshot*> hazard{nullptr};
+        char pad[memory::Alignment - sizeof(std::atomic<bool>) -
+                 sizeof(std::atomic<const Snapshot*>)];
+    };
+
+public:
+    /** The network type. */
+    using Net = BasicNeuralNet<T, W>;
+
+    /**
+     * A reader's hold on one snapshot.  The snapshot (and its network)
+     * stays valid and unchanged until the reader is destroyed.  A
+     * reader is meant to be short lived, e.g., for one classification.
+     */
+    class Reader {
+        friend class BasicWeightSnapshots;
+
+    public:
+        Reader(Reader&& other) noexcept :
+            slot(other.slot), snapshot(other.snapshot) {
+            other.slot = nullptr;
+        }
+
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+        Reader& operator=(Reader&&) = delete;
+
+        /** Releases the snapshot so that it can be reclaimed. */
+        ~Reader() {
+            if (slot != nullptr) {
+                slot->hazard.store(nullptr, std::memory_order_release);
+                slot->busy.store(false, std::memory_order_release);
+            }
+        }
+
+        /** Returns the network of the snapshot. */
+        const Net& operator*() const { return snapshot->net; }
+
+        /** Returns the network of the snapshot. */
+        const Net* operator->() const { return &snapshot->net; }
+
+        /** Returns the version of the snapshot, counting from 0 for
+            the snapshot made by the constructor. */
+        uint64_t version() const { return snapshot->version; }
+
+    private:
+        Reader(Slot* slot, const Snapshot* snapshot) :
+            slot(slot), snapshot(snapshot) {}
+
+        /** The slot holding the snapshot, or nullptr if moved from. */
+        Slot* slot;
+
+        /** The snapshot being read. */
+        const Snapshot* snapshot;
+    };
+
+    /**
+     * Creates the first snapshot (version 0) of a network.
+     *
+     * \param[in] net The network to be copied.
+     *
+     * \param[in] interval The number of samples after which trained()
+     * publishes a new snapshot.  Values less than 1 are treated as 1.
+     *
+     * \param[in] maxReaders The maximum number of readers that hold a
+     * snapshot at the same time.  Additional readers wait in acquire()
+     * until a reader is destroyed.  Zero (the default) means twice
+     * the concurrency of ThreadPool::global().
+     */
+    explicit BasicWeightSnapshots(const Net& net, size_t interval = 1000,
+                                  size_t maxReaders = 0);
+
+    /** Releases all the snapshots.  No readers may exist. */
+    ~BasicWeightSnapshots();
+
+    BasicWeightSnapshots(const BasicWeightSnapshots&) = delete;
+    BasicWeightSnapshots& operator=(const BasicWeightSnapshots&) = delete;
+
+    /**
+     * Returns a hold on the current snapshot.  This method never
+     * locks and only waits if \c maxReaders readers already exist.
+     * It may be called by any number of threads concurrently.
+     */
+    Reader acquire() const;
+
+    /**
+     * Publishes a copy of a network as the current snapshot and
+     * reclaims any replaced snapshots that are no longer read.
+     * Concurrent calls are serialized.
+     *
+     * \param[in] net The network to be copied.  It must not change
+     * during this call.
+     *
+     * \return The version of the new snapshot.
+     */
+    uint64_t publish(const Net& net);
+
+    /**
+     * Notes that a network learned from some samples, and publishes
+     * it once \c interval samples were learned since the last
+     * snapshot.  Call this from the training thread after learning.
+     *
+     * \param[in] net The network being trained.
+     *
+     * \param[in] samples The number of samples just learned.
+     *
+     * \return True if a snapshot was published.
+     */
+    bool trained(const Net& net, size_t samples = 1);
+
+    /** Returns the version of the current snapshot. */
+    uint64_t version() const { return latest.load(); }
+
+private:
+    /** Deletes (or keeps for reuse) the retired snapshots that no
+        reader holds.  The caller must hold publishLock. */
+    void reclaim();
+
+    /** The current snapshot. */
+    std::atomic<Snapshot*> current;
+
+    /** The version of the current snapshot, kept apart from it since
+        the current snapshot may be reclaimed while it is read. */
+    std::atomic<uint64_t> latest{0};
+
+    /** The slots of the readers. */
+    std::unique_ptr<Slot[]> slots;
+
+    /** The number of entries in slots. */
+    size_t slotCount;
+
+    /** Lock serializing publish() and trained(). */
+    std::mutex publishLock;
+
+    /** Replaced snapshots that may still be read. */
+    std::vector<Snapshot*> retired;
+
+    /** The snapshots held by readers, collected by reclaim().  It is
+        a member so that its storage is reused. */
+    std::vector<const Snapshot*> held;
+
+    /** A reclaimed snapshot whose storage is reused by publish(). */
+    std::unique_ptr<Snapshot> spare;
+
+    /** The number of samples per snapshot for trained(). */
+    const size_t interval;
+
+    /** The number of samples learned since the last snapshot. */
+    size_t pending = 0;
+};
+
+/** The snapshots for the default neural network. */
+using WeightSnapshots = BasicWeightSnapshots<Val>;
+
+extern template class BasicWeightSnapshots<double>;
+extern template class BasicWeightSnapshots<float>;
+extern template class BasicWeightSnapshots<float, BFloat16>;
+extern template class BasicWeightSnapshots<float, Float16>;
+
+#endif
@@ -14,7 +14,14 @@
 #include <iomanip>
 #include <iostream>
 #include <chrono>
+#include <algorithm>
+#include <array>
+#include <memory>
 #include "NeuralNet.h"
+#include "DataLoader.h"
+#include "ParameterServer.h"
+#include "Numa.h"
+#include "ThreadPool.h"
 
 /**
  * Helper method to load a PGM data file into a 1-D matrix that can be
@@ -73,7 +80,9 @@ Matrix getExpectedDigitOutput(const std::string& path) {
 
 /**
  * Helper method to use the first \c count number of files to train a
- * given neural network.
+ * given neural network.  The images are read and decoded in batches
+ * by background threads (see DataLoader) while the network trains
+ * with the previously loaded batches.
  *
  * \param[in,out] net The neural network to be trainined.
  *
@@ -84,37 +93,99 @@ Matrix getExpectedDigitOutput(const std::string& path) {
  * for training.
  *
  * \param[in] count The number of files in this list ot be used.
+ *
+ * \param[in] threads The number of threads to train with.  If more
+ * than 1 (and batchSize is 0), the images are learned in parallel via
+ * NeuralNet::trainHogwild.
+ *
+ * \param[in] batchSize If positive, the images are learned in
+ * mini-batches of this size via NeuralNet::trainParallel, which gives
+ * reproducible results for a given number of threads.
  */
 void train(NeuralNet& net, const std::string& path,
            const std::vector<std::string>& fileNames,
-           int count = 1e6) {
-    for (const auto& imgName : fileNames) {
-        const Matrix img = loadPGM(path + "/" + imgName);
-        const Matrix exp = getExpectedDigitOutput(imgName);
-        net.learn(img, exp);
-        if (count-- <= 0) {
-            break;
+           int count = 1e6, const int threads = 1, const int batchSize = 0) {
+    // Batches of the loader hold whole mini-batches, so that training
+    // batch by batch is the same as training with all the images.
+    const size_t miniBatch  = std::max(batchSize, 1);
+    const size_t loadBatch  = (63 / miniBatch + 1) * miniBatch;
+    const size_t imgCount   = std::min<size_t>(count, fileNames.size());
+    DataLoader loader(imgCount, loadBatch, 784, 10,
+                      [&](const size_t i, Dataset& batch) {
+                          batch.add(loadPGM(path + "/" + fileNames[i]),
+                                    getExpectedDigitOutput(fileNames[i]));
+                      });
+    for (Dataset batch; loader.next(batch);) {
+        if (batchSize > 0) {
+            net.trainParallel(batch, batchSize, threads);
+        } else if (threads > 1) {
+            net.trainHogwild(batch, threads);
+        } else {
+            for (size_t i = 0; (i < batch.size()); i++) {
+                net.learn(batch.input(i), batch.expected(i));
+            }
         }
     }
 }
 
 /**
- * The top-level method to train a given neural network used a list of
- * files from a given training set.
+ * Helper method to load a list of PGM files, along with the expected
+ * output for each, into a dataset.
  *
- * \param[in,out] net The neural network to be trained.
+ * \param[in] path The prefix path to the location where the images
+ * are actually stored.
  *
- * \param[in] path The prefix path to the location where the training
- * images are actually stored.
+ * \param[in] fileNames The list of PGM image file names to be loaded.
  *
- * \param[in] limit The number of files to be used to train the network.
+ * \return The dataset with one sample per file, in the given order.
+ */
+Dataset loadDataset(const std::string& path,
+                    const std::vector<std::string>& fileNames) {
+    Dataset data(784, 10);
+    data.reserve(fileNames.size());
+    for (const auto& imgName : fileNames) {
+        data.add(loadPGM(path + "/" + imgName),
+                 getExpectedDigitOutput(imgName));
+    }
+    return data;
+}
+
+/**
+ * Helper method to load all the PGM files listed in a given file into
+ * a dataset.
  *
- * \param[in] imgListFile The file that contains a list of PGM files
- * to be used.  This method randomly shuffles this list before using
- * \c limit nunber of images for training the supplied \c net.
+ * \param[in] path The prefix path to the location where the images
+ * are actually stored.
+ *
+ * \param[in] imgFileList A text file containing the list of
+ * image-file-names to be loaded.
+ *
+ * \return The dataset with one sample per file, in the listed order.
  */
-void train(NeuralNet& net, const std::string& path, const int limit = 1e6,
-           const std::string& imgListFile = "TrainingSetList.txt") {
+Dataset loadDataset(const std::string& path, const std::string& imgFileList) {
+    std::ifstream fileList(imgFileList);
+    if (!fileList) {
+        throw std::runtime_error("Error reading " + imgFileList);
+    }
+    std::vector<std::string> fileNames;
+    for (std::string imgName; std::getline(fileList, imgName);) {
+        fileNames.push_back(imgName);
+    }
+    return loadDataset(path, fileNames);
+}
+
+/**
+ * Helper method to read the list of training files and to randomly
+ * shuffle it.  The shuffle is the same in every run (and process).
+ *
+ * \param[in] limit The maximum number of file names to be read.
+ *
+ * \param[in] imgListFile The file that contains a list of PGM files.
+ *
+ * \return The first \c limit file names in the list, shuffled.
+ */
+std::vector<std::string> getTrainingFiles(const int limit,
+                                          const std::string& imgListFile) {
     std::ifstream fileList(imgListFile);
     if (!fileList) {
         throw std::runtime_error("Error reading: " + imgListFile);
@@ -131,66 +202,231 @@ void train(NeuralNet& net, const std::string& path, const int limit = 1e6,
     std::default_random_engine rg;
     std::shuffle(fileNames.begin(), fileNames.end(),
                  std::default_random_engine());
+    return fileNames;
+}
+
+/**
+ * The top-level method to train a given neural network used a list of
+ * files from a given training set.
+ *
+ * \param[in,out] net The neural network to be trained.
+ *
+ * \param[in] path The prefix path to the location where the training
+ * images are actually stored.
+ *
+ * \param[in] limit The number of files to be used to train the network.
+ *
+ * \param[in] imgListFile The file that contains a list of PGM files
+ * to be used.  This method randomly shuffles this list before using
+ * \c limit nunber of images for training the supplied \c net.
+ *
+ * \param[in] threads The number of threads to train with.
+ *
+ * \param[in] batchSize The mini-batch size, or 0 for plain stochastic
+ * gradient descent.
+ */
+void train(NeuralNet& net, const std::string& path, const int limit = 1e6,
+           const std::string& imgListFile = "TrainingSetList.txt",
+           const int threads = 1, const int batchSize = 0) {
     // Use the helper method to train
-    train(net, path, fileNames, limit);
+    train(net, path, getTrainingFiles(limit, imgListFile), limit, threads,
+          batchSize);
 }
 
 /**
  * Helper method to get the index of the maximum element in a given
- * list. For example maxElemIndex({1, 3, -1, 2}) returns 1.
+ * list. For example, for a row matrix with values {1, 3, -1, 2} this
+ * method returns 1.
  *
- * \param[in] vec The vector whose maximum element index is to be
- * returned by this method. This list cannot be empty.
+ * \param[in] vec The row or column vector (or view) whose maximum
+ * element index is to be returned by this method. This list cannot be
+ * empty.
  *
  * \return The index position of the maximum element.
  */
-int maxElemIndex(const std::vector<Val>& vec) {
-    return std::max_element(vec.begin(), vec.end()) - vec.begin();
+int maxElemIndex(ConstMatrixView vec) {
+    int maxIdx = 0, idx = 0;
+    Val maxVal = vec(0, 0);
+    for (size_t r = 0; (r < vec.height()); r++) {
+        for (size_t c = 0; (c < vec.width()); c++, idx++) {
+            if (vec(r, c) > maxVal) {
+                maxVal = vec(r, c);
+                maxIdx = idx;
+            }
+        }
+    }
+    return maxIdx;
 }
 
-
 /**
  * Helper method to determine how well a given neural network has
- * trained used a list of test images.
+ * trained using a set of test images.  The images are classified in
+ * batches (via NeuralNet::classifyBatch) that are spread across the
+ * thread pool.  Each batch counts its results separately and the
+ * counts are added up at the end.  In the NUMA-aware mode (see
+ * Numa.h) the network is replicated on each NUMA node first.
  *
  * \param[in] net The network to be used for classification.
  *
- * \param[in] path The prefix path to the location where the training
- * images are actually stored.
+ * \param[in] tests The test images along with their expected
+ * outputs.
  *
- * \param[in] imgFileList A text file containing the list of
- * image-file-names to be used for assessing the effectiveness of the
- * supplied \c net.
+ * \param[in] batchSize The number of images classified at once.
  */
-void assess(NeuralNet& net, const std::string& path,
-            const std::string& imgFileList = "TestingSetList.txt") {
-    std::ifstream fileList2(imgFileList);
-    if (!fileList2) {
-        throw std::runtime_error("Error reading " + imgFileList);
+void assess(const NeuralNet& net, const Dataset& tests,
+            const size_t batchSize = 256) {
+    // The confusion matrix: confusion[e][r] is the number of images of
+    // digit e that were classified as digit r.
+    using Confusion = std::array<std::array<int, 10>, 10>;
+    const size_t batches = (tests.size() + batchSize - 1) / batchSize;
+    std::vector<Confusion> counts(batches, Confusion{});
+    // In the NUMA-aware mode each batch is classified with a copy of
+    // the network on the node of the thread running it.
+    std::unique_ptr<const NodeReplicas<NeuralNet>> nodeNets;
+    if (numa::enabled()) {
+        nodeNets.reset(new NodeReplicas<NeuralNet>(net));
+    }
+    TaskGroup group;
+    for (size_t b = 0; (b < batches); b++) {
+        group.run([&, b] {
+            const size_t begin = b * batchSize;
+            const size_t end   = std::min(begin + batchSize, tests.size());
+            // The results have one column per image.
+            const NeuralNet& local = nodeNets ? nodeNets->local() : net;
+            const Matrix res =
+                local.classifyBatch(tests.inputBatch(begin, end));
+            for (size_t i = begin; (i < end); i++) {
+                const int expIdx = maxElemIndex(tests.expected(i));
+                const int resIdx = maxElemIndex(res.column(i - begin));
+                counts[b][expIdx][resIdx]++;
+            }
+        });
     }
-    // Check how many of the images are correctly classified by the
-    // given given neural network.
-    auto passCount = 0, totCount = 0;;
-    for (std::string imgName; std::getline(fileList2, imgName); totCount++) {
-        const Matrix img = loadPGM(path + "/" + imgName);
-        const Matrix exp = getExpectedDigitOutput(imgName);
-        // Have our network classify the image.
-        const Matrix res = net.classify(img);
-        assert(res.width() == 1);
-        assert(res.height() == 10);
-        // Find the maximum index positions in exp results to see if
-        // they are the same. If they are it is a good
-        // result. Otherwise, it is an error.
-        const int expIdx = maxElemIndex(exp.transpose());
-        const int resIdx = maxElemIndex(res.transpose());
-        if (expIdx == resIdx) {
-            passCount++;
+    group.wait();
+
+    // Add up the counts of all the batches.
+    Confusion confusion{};
+    int passCount = 0;
+    for (const auto& batch : counts) {
+        for (int e = 0; (e < 10); e++) {
+            for (int r = 0; (r < 10); r++) {
+                confusion[e][r] += batch[e][r];
+            }
+            passCount += batch[e][e];
         }
-        // std::cout << imgName.substr(imgName.rfind('/'))
-        //           << '\t' << expIdx << '\t' << resIdx << '\n';
     }
+    const int totCount = tests.size();
     std::cout << "Correct classification: " << passCount << " ["
               << (passCount * 1.f / totCount) << "% ]\n";
+    std::cout << "Confusion matrix (rows: expected, columns: classified):\n";
+    for (int e = 0; (e < 10); e++) {
+        std::cout << e << ':';
+        for (int r = 0; (r < 10); r++) {
+            std::cout << std::setw(6) << confusion[e][r];
+        }
+        std::cout << '\n';
+    }
+}
+
+/**
+ * Runs a parameter server for distributed training (see
+ * ParameterServer.h) and assesses the trained network once all the
+ * workers are done.
+ *
+ * \param[in] argc The number of arguments after "serve".
+ *
+ * \param[in] argv The arguments after "serve":
+ *     1. The address to listen at (unix:path or tcp:host:port).
+ *     2. The number of worker processes.
+ *     3. The path where test images are stored.
+ *     4. The update mode: "sync" (the default), or "async:N" for
+ *        asynchronous updates at most N updates stale.
+ *     5. The file containing the list of testing images to be used.
+ */
+int serve(int argc, char *argv[]) {
+    if (argc < 4) {
+        std::cout << "Usage: serve <Address> <#Workers> <ImgPath> "
+                  << "[sync|async:N] [TestSetList]\n";
+        return 1;
+    }
+    ParameterServer::Options options;
+    options.workers = std::stoi(argv[2]);
+    const std::string mode = (argc > 4 ? argv[4] : "sync");
+    if (mode.compare(0, 5, "async") == 0) {
+        options.mode = UpdateMode::Async;
+        if (mode.size() > 6) {
+            options.maxStaleness = std::stoi(mode.substr(6));
+        }
+    }
+    const std::string testImgs = (argc > 5 ? argv[5] : "TestingSetList.txt");
+
+    NeuralNet net({784, 30, 10});
+    ParameterServer server(net, options);
+    server.serve(argv[1]);
+    std::cout << "Applied " << server.version() << " updates.\n";
+    assess(net, loadDataset(argv[3], testImgs));
+    return 0;
+}
+
+/**
+ * Runs a worker process that trains on its shard of the training
+ * images and synchronizes with a parameter server after each
+ * mini-batch.
+ *
+ * \param[in] argc The number of arguments after "work".
+ *
+ * \param[in] argv The arguments after "work":
+ *     1. The address of the server (unix:path or tcp:host:port).
+ *     2. The index of this worker, from 0 to #Workers - 1.
+ *     3. The number of worker processes.
+ *     4. The path where training images are stored.
+ *     5. The number of images to be used (by all the workers).
+ *     6. Number of ephocs to be used for training.
+ *     7. The file containing the list of training images to be used.
+ *     8. The number of images learned between pushes to the server.
+ */
+int work(int argc, char *argv[]) {
+    if (argc < 5) {
+        std::cout << "Usage: work <Address> <Rank> <#Workers> <ImgPath> "
+                  << "[#Train] [#Epocs] [TrainSetList] [#Batch]\n";
+        return 1;
+    }
+    const int rank      = std::stoi(argv[2]);
+    const int workers   = std::stoi(argv[3]);
+    const int imgCount  = (argc > 5 ? std::stoi(argv[5]) : 5000);
+    const int epochs    = (argc > 6 ? std::stoi(argv[6]) : 10);
+    const std::string trainImgs = (argc > 7 ? argv[7] : "TrainingSetList.txt");
+    const size_t batchSize = (argc > 8 ? std::stoi(argv[8]) : 10);
+
+    // Every worker shuffles the list the same way and uses every
+    // workers-th image of it.
+    const auto fileNames = getTrainingFiles(imgCount, trainImgs);
+    std::vector<std::string> shard;
+    for (size_t i = rank; (i < fileNames.size()); i += workers) {
+        shard.push_back(fileNames[i]);
+    }
+    const Dataset data = loadDataset(argv[4], shard);
+
+    NeuralNet net({784, 30, 10});
+    ParameterClient client(argv[1]);
+    client.pull(net);
+    size_t pushes = 0, rejected = 0;
+    for (int epoch = 0; (epoch < epochs); epoch++) {
+        for (size_t begin = 0; (begin < data.size()); begin += batchSize) {
+            const MatrixVec biases = net.getBiases();
+            const MatrixVec weights = net.getWeights();
+            const size_t end = std::min(begin + batchSize, data.size());
+            for (size_t i = begin; (i < end); i++) {
+                net.learn(data.input(i), data.expected(i));
+            }
+            rejected += !client.push(net, biases, weights);
+            pushes++;
+        }
+    }
+    client.done();
+    std::cout << "Worker " << rank << ": " << pushes << " pushes ("
+              << rejected << " stale).\n";
+    return 0;
 }
 
 /**
@@ -199,7 +435,7 @@ void assess(NeuralNet& net, const std::string& path,
  *
  * \param[in] argc The numebr of command-line arguments.  This program
  * requires one path where training & test images are stored. It
- * optionally accepts up to 4 optional command-line arguments.
+ * optionally accepts up to 6 optional command-line arguments.
  *
  * \param[in] argv The actual command-line argument.
  *     1. The path where training and test images are stored.
@@ -212,21 +448,43 @@ void assess(NeuralNet& net, const std::string& path,
  *     5. The file containing the list of testing images to be
  *        used. By default this parameter is set to
  *        "TestingSetList.txt".
+ *     6. The number of threads used for training.  The default is 1,
+ *        i.e., sequential training.  With more threads, training is
+ *        lock-free (see NeuralNet::trainHogwild) and not reproducible.
+ *     7. The mini-batch size.  If given, training uses synchronous
+ *        mini-batches split across the threads (see
+ *        NeuralNet::trainParallel) instead.
+ *
+ * Alternatively, "serve" or "work" as the first argument runs a
+ * parameter server or one of its workers for distributed training
+ * (see the serve and work functions above).
  */
 int main(int argc, char *argv[]) {
     // We definitely need 1 argument for the base-path where image
     // files are stored.
     if (argc < 2) {
         std::cout << "Usage: <ImgPath> [#Train] [#Epocs] [TrainSetList] "
-                  << "[TestSetList]\n";
+                  << "[TestSetList] [#Threads] [#Batch]\n"
+                  << "   or: serve <Address> <#Workers> <ImgPath> ...\n"
+                  << "   or: work <Address> <Rank> <#Workers> <ImgPath> ...\n";
         return 1;
     }
+    // Check for the roles used for distributed training.
+    if (std::string(argv[1]) == "serve") {
+        return serve(argc - 1, argv + 1);
+    } else if (std::string(argv[1]) == "work") {
+        return work(argc - 1, argv + 1);
+    }
     // Process optional command-line arguments or use default values.
     const int imgCount  = (argc > 2 ? std::stoi(argv[2]) : 5000);
     const int epochs    = (argc > 3 ? std::stoi(argv[3]) : 10);
     const std::string trainImgs = (argc > 4 ? argv[4] : "TrainingSetList.txt");
     const std::string testImgs  = (argc > 5 ? argv[5] : "TestingSetList.txt");
+    const int threads   = (argc > 6 ? std::stoi(argv[6]) : 1);
+    const int batchSize = (argc > 7 ? std::stoi(argv[7]) : 0);
 
+    // Load the test images once, as they are used after every epoch.
+    const Dataset tests = loadDataset(argv[1], testImgs);
     // Create the neural netowrk
     NeuralNet net({784, 30, 10});
     // Train it in at most 30 epochs.
@@ -234,8 +492,8 @@ int main(int argc, char *argv[]) {
         std::cout << "-- Epoch #" << i << " --\n";
         std::cout << "Training with " << imgCount << " images...\n";
         const auto startTime = std::chrono::high_resolution_clock::now();
-        train(net, argv[1], imgCount, trainImgs);
-        assess(net, argv[1], testImgs);
+        train(net, argv[1], imgCount, trainImgs, threads, batchSize);
+        assess(net, tests);
         const auto endTime = std::chrono::high_resolution_clock::now();
         // Compute the timeelapsed for this epoch
         using namespace std::literals;